@@ -0,0 +1,596 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "shred_engine.h"
+#include "shred_parse.h"
+
+// Throughput benchmarks for the shredding engine. Every combination of
+// directory, file size, algorithm, backend and block size is run against
+// a freshly written file, and the kernels the passes are built from are
+// timed on their own. Results go to stdout as JSON, progress to stderr.
+
+#define BENCH_MAX_ITEMS 16
+
+// Each micro-benchmark runs for at least this long
+#define BENCH_MICRO_SECONDS 0.25
+#define BENCH_MICRO_SIZE (4 * 1024 * 1024)
+
+typedef struct {
+    const char* dirs[BENCH_MAX_ITEMS];
+    size_t dir_count;
+    size_t sizes[BENCH_MAX_ITEMS];
+    size_t size_count;
+    ShredAlgorithm algorithms[BENCH_MAX_ITEMS];
+    size_t algorithm_count;
+    ShredBackend backends[BENCH_MAX_ITEMS];
+    size_t backend_count;
+    size_t block_sizes[BENCH_MAX_ITEMS];
+    size_t block_size_count;
+    size_t pass_windows[BENCH_MAX_ITEMS];  // 0 is the whole-file sweep
+    size_t pass_window_count;
+    unsigned int threads;
+    unsigned int repeat;
+    int files;   // run the file benchmarks
+    int micro;   // run the kernel micro-benchmarks
+} BenchConfig;
+
+// One file benchmark
+typedef struct {
+    const char* dir;
+    const char* path;
+    size_t size;
+    ShredAlgorithm algorithm;
+    ShredBackend backend;
+    size_t block_size;
+    size_t pass_window;
+} BenchCase;
+
+typedef void (*BenchKernel)(void* context);
+
+typedef struct {
+    unsigned char* a;
+    unsigned char* b;
+    size_t length;
+    ShredKeystream stream;
+    const unsigned char* pattern;
+    size_t tile_size;
+} BenchContext;
+
+// Keeps results of the compare kernels alive
+static volatile size_t sink;
+
+// Splits a comma-separated option in place; returns the item count or -1
+static int split_list(char* text, char** items) {
+    int count = 0;
+
+    for (char* item = strtok(text, ","); item; item = strtok(NULL, ",")) {
+        if (count == BENCH_MAX_ITEMS) {
+            return -1;
+        }
+        items[count++] = item;
+    }
+    return count;
+}
+
+static void print_string(const char* text) {
+    putchar('"');
+    for (; *text; text++) {
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static double cpu_seconds(void) {
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1e6 +
+           (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1e6;
+}
+
+// Writes size bytes of incompressible data so every block is allocated
+static int create_file(const char* path, size_t size) {
+    ShredBuffer buffer;
+    uint64_t state = 0x9e3779b97f4a7c15ULL ^ size;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    if (shred_buffer_acquire(&buffer, SHRED_BUFFER_SIZE) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    int status = 0;
+    for (size_t offset = 0; offset < size && status == 0; offset += buffer.size) {
+        size_t length = size - offset < buffer.size ? size - offset : buffer.size;
+
+        // xorshift64, only needs to defeat compression and deduplication
+        for (size_t i = 0; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            memcpy(buffer.data + i, &state, sizeof(state));
+        }
+        if (pwrite(fd, buffer.data, length, (off_t)offset) != (ssize_t)length) {
+            status = -1;
+        }
+    }
+
+    if (status == 0) {
+        status = shred_io_sync(fd);
+    }
+    shred_buffer_release(&buffer);
+    close(fd);
+    return status;
+}
+
+// Returns the MB/s of the case, 0 when it failed. pwrite_mbps is what the
+// pwrite backend made of the same case and sweep_mbps what the same
+// backend made of it without a pass window, 0 where they were not run.
+static double run_case(const BenchConfig* config, const BenchCase* bench_case, double pwrite_mbps,
+                       double sweep_mbps, int* first) {
+    ShredOptions options;
+    size_t pass_count;
+    double best = 0.0, cpu = 0.0, seconds = 0.0, mbps = 0.0;
+    uint64_t written = 0, syscalls = 0;
+    int error = 0;
+
+    shred_options_init(&options);
+    options.backend = bench_case->backend;
+    options.block_size = bench_case->block_size;
+    options.pass_window = bench_case->pass_window;
+    options.threads = config->threads;
+    shred_algorithm_passes(bench_case->algorithm, &pass_count);
+
+    fprintf(stderr, "%s: %zu bytes, %s, %s, %zu byte blocks", bench_case->dir, bench_case->size,
+            shred_algorithm_name(bench_case->algorithm), shred_backend_name(bench_case->backend),
+            bench_case->block_size);
+    if (bench_case->pass_window > 0) {
+        fprintf(stderr, ", %zu byte pass windows", bench_case->pass_window);
+    }
+    fprintf(stderr, "\n");
+
+    for (unsigned int run = 0; run < config->repeat && !error; run++) {
+        ShredResult result;
+        double cpu_start = cpu_seconds();
+        uint64_t syscalls_start = shred_io_syscalls();
+
+        if (shred_path(bench_case->path, bench_case->algorithm, &options, &result) != 0) {
+            error = errno;
+            break;
+        }
+
+        cpu += cpu_seconds() - cpu_start;
+        syscalls += shred_io_syscalls() - syscalls_start;
+        written += result.bytes_written;
+        seconds += result.seconds;
+        if (shred_result_mbps(&result) > best) {
+            best = shred_result_mbps(&result);
+        }
+    }
+
+    printf("%s\n    {\"dir\": ", *first ? "" : ",");
+    print_string(bench_case->dir);
+    printf(", \"size\": %zu, \"algorithm\": \"%s\", \"passes\": %zu, \"backend\": \"%s\", "
+           "\"block_size\": %zu, \"pass_window\": %zu, \"threads\": %u, ",
+           bench_case->size, shred_algorithm_name(bench_case->algorithm), pass_count,
+           shred_backend_name(bench_case->backend), bench_case->block_size, bench_case->pass_window,
+           config->threads);
+    if (error) {
+        printf("\"error\": ");
+        print_string(strerror(error));
+        printf("}");
+    } else {
+        double gigabytes = (double)written / 1e9;
+        mbps = seconds > 0.0 ? (double)written / seconds / 1e6 : 0.0;
+        printf("\"runs\": %u, \"bytes_written\": %llu, \"mbps\": %.1f, \"mbps_best\": %.1f, "
+               "\"cpu_seconds_per_gb\": %.4f, \"syscalls\": %llu, \"syscalls_per_gb\": %.1f",
+               config->repeat, (unsigned long long)(written / config->repeat), mbps, best,
+               gigabytes > 0.0 ? cpu / gigabytes : 0.0,
+               (unsigned long long)(syscalls / config->repeat),
+               gigabytes > 0.0 ? (double)syscalls / gigabytes : 0.0);
+        if (bench_case->backend != SHRED_BACKEND_PWRITE && pwrite_mbps > 0.0) {
+            printf(", \"vs_pwrite\": %.3f", mbps / pwrite_mbps);
+        }
+        if (bench_case->pass_window > 0 && sweep_mbps > 0.0) {
+            printf(", \"vs_sweep\": %.3f", mbps / sweep_mbps);
+        }
+        printf("}");
+    }
+    *first = 0;
+    return mbps;
+}
+
+static void run_files(const BenchConfig* config) {
+    int first = 1;
+
+    printf("  \"cases\": [");
+    for (size_t d = 0; d < config->dir_count; d++) {
+        for (size_t s = 0; s < config->size_count; s++) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/zyafs-bench-%ld-%zu.dat", config->dirs[d], (long)getpid(),
+                     config->sizes[s]);
+
+            if (create_file(path, config->sizes[s]) != 0) {
+                fprintf(stderr, "Error: Unable to create %s: %s.\n", path, strerror(errno));
+                unlink(path);
+                continue;
+            }
+
+            BenchCase bench_case = { config->dirs[d], path, config->sizes[s], 0, 0, 0, 0 };
+            for (size_t a = 0; a < config->algorithm_count; a++) {
+                size_t pass_count;
+                shred_algorithm_passes(config->algorithms[a], &pass_count);
+                bench_case.algorithm = config->algorithms[a];
+
+                // pwrite goes first so every other backend can be compared with it
+                double baselines[BENCH_MAX_ITEMS][BENCH_MAX_ITEMS] = { { 0.0 } };
+                for (int pwrite_only = 1; pwrite_only >= 0; pwrite_only--) {
+                    for (size_t b = 0; b < config->backend_count; b++) {
+                        if ((config->backends[b] == SHRED_BACKEND_PWRITE) != pwrite_only) {
+                            continue;
+                        }
+                        bench_case.backend = config->backends[b];
+                        for (size_t k = 0; k < config->block_size_count; k++) {
+                            double sweep = 0.0;
+                            bench_case.block_size = config->block_sizes[k];
+                            for (size_t w = 0; w < config->pass_window_count; w++) {
+                                // Windows change nothing about a single pass
+                                bench_case.pass_window = config->pass_windows[w];
+                                if (bench_case.pass_window > 0 && pass_count < 2) {
+                                    continue;
+                                }
+
+                                double mbps = run_case(config, &bench_case, baselines[k][w], sweep, &first);
+                                if (pwrite_only) {
+                                    baselines[k][w] = mbps;
+                                }
+                                if (bench_case.pass_window == 0) {
+                                    sweep = mbps;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            unlink(path);
+        }
+    }
+    printf("\n  ]");
+}
+
+static void kernel_memset(void* context) {
+    BenchContext* bench = context;
+    memset(bench->a, 0x55, bench->length);
+}
+
+static void kernel_pattern_fill(void* context) {
+    BenchContext* bench = context;
+    shred_pattern_fill(bench->a, bench->length, bench->pattern, SHRED_PATTERN_PERIOD, 1);
+}
+
+static void kernel_pattern_tile(void* context) {
+    BenchContext* bench = context;
+    shred_pattern_tile_release(shred_pattern_tile_acquire(bench->pattern, SHRED_PATTERN_PERIOD, 0,
+                                                          bench->tile_size));
+}
+
+static void kernel_memcpy(void* context) {
+    BenchContext* bench = context;
+    memcpy(bench->b, bench->a, bench->length);
+}
+
+static void kernel_store_stream(void* context) {
+    BenchContext* bench = context;
+    shred_store_stream(bench->b, bench->a, bench->length);
+}
+
+static void kernel_keystream(void* context) {
+    BenchContext* bench = context;
+    shred_keystream_generate(&bench->stream, bench->a, bench->length);
+}
+
+static void kernel_memcmp(void* context) {
+    BenchContext* bench = context;
+    sink = (size_t)memcmp(bench->a, bench->b, bench->length);
+}
+
+static void kernel_mismatch(void* context) {
+    BenchContext* bench = context;
+    sink = shred_mismatch(bench->a, bench->b, bench->length);
+}
+
+// Runs kernel until BENCH_MICRO_SECONDS have passed, after one warm-up call
+static double time_kernel(BenchKernel kernel, void* context, uint64_t* iterations) {
+    kernel(context);
+
+    double start = shred_io_now(), elapsed;
+    *iterations = 0;
+    do {
+        kernel(context);
+        (*iterations)++;
+        elapsed = shred_io_now() - start;
+    } while (elapsed < BENCH_MICRO_SECONDS);
+
+    return elapsed;
+}
+
+// bytes is what one call processes; 0 reports nanoseconds per call instead
+static void report_kernel(const char* name, const char* variant, BenchKernel kernel, void* context,
+                          size_t bytes, int* first) {
+    uint64_t iterations;
+    double seconds = time_kernel(kernel, context, &iterations);
+
+    fprintf(stderr, "micro: %s%s%s\n", name, variant ? " " : "", variant ? variant : "");
+    printf("%s\n    {\"name\": \"%s\", ", *first ? "" : ",", name);
+    if (variant) {
+        printf("\"variant\": \"%s\", ", variant);
+    }
+    printf("\"iterations\": %llu, \"seconds\": %.4f, ", (unsigned long long)iterations, seconds);
+    if (bytes) {
+        printf("\"bytes\": %zu, \"mbps\": %.1f}", bytes, (double)bytes * (double)iterations / seconds / 1e6);
+    } else {
+        printf("\"ns_per_op\": %.1f}", seconds * 1e9 / (double)iterations);
+    }
+    *first = 0;
+}
+
+static int run_micro(void) {
+    static const unsigned char pattern[SHRED_PATTERN_PERIOD] = { 0x92, 0x49, 0x24 };
+    static const unsigned char key[SHRED_KEY_SIZE];
+    static const unsigned char nonce[SHRED_NONCE_SIZE];
+    static const ShredCipher ciphers[] = { SHRED_CIPHER_AES_CTR, SHRED_CIPHER_CHACHA20 };
+    ShredBuffer a, b;
+    BenchContext bench;
+    int first = 1;
+
+    if (shred_buffer_acquire(&a, BENCH_MICRO_SIZE) != 0 || shred_buffer_acquire(&b, BENCH_MICRO_SIZE) != 0) {
+        return -1;
+    }
+    memset(&bench, 0, sizeof(bench));
+    bench.a = a.data;
+    bench.b = b.data;
+    bench.length = BENCH_MICRO_SIZE;
+    bench.pattern = pattern;
+    bench.tile_size = shred_pattern_tile_size(SHRED_BUFFER_SIZE, (size_t)sysconf(_SC_PAGESIZE));
+
+    printf("  \"micro\": [");
+    report_kernel("memset", NULL, kernel_memset, &bench, bench.length, &first);
+    report_kernel("pattern_fill", NULL, kernel_pattern_fill, &bench, bench.length, &first);
+    report_kernel("pattern_tile", NULL, kernel_pattern_tile, &bench, 0, &first);
+    report_kernel("memcpy", NULL, kernel_memcpy, &bench, bench.length, &first);
+    report_kernel("store_stream", shred_store_kernel_name(), kernel_store_stream, &bench, bench.length, &first);
+
+    for (size_t i = 0; i < sizeof(ciphers) / sizeof(ciphers[0]); i++) {
+        if (shred_keystream_init(&bench.stream, ciphers[i]) != 0) {
+            continue;
+        }
+        if (shred_keystream_start(&bench.stream, key, nonce, 0) == 0) {
+            report_kernel("keystream", shred_cipher_name(ciphers[i]), kernel_keystream, &bench,
+                          bench.length, &first);
+        }
+        shred_keystream_free(&bench.stream);
+    }
+
+    // Equal buffers, so both compare kernels scan all of them
+    memset(bench.a, 0xA5, bench.length);
+    memset(bench.b, 0xA5, bench.length);
+    report_kernel("memcmp", NULL, kernel_memcmp, &bench, bench.length, &first);
+    report_kernel("mismatch", NULL, kernel_mismatch, &bench, bench.length, &first);
+    printf("\n  ]");
+
+    shred_buffer_release(&a);
+    shred_buffer_release(&b);
+    return 0;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --dirs=DIR,...             where test files are created (default: /dev/shm and .)\n");
+    fprintf(stderr, "  --sizes=SIZE,...           test file sizes (default: 1M,64M)\n");
+    fprintf(stderr, "  --algorithms=NAME,...      algorithms to run (default: all)\n");
+    fprintf(stderr, "  --backends=NAME,...        I/O backends to run (default: all)\n");
+    fprintf(stderr, "  --block-sizes=SIZE,...     buffer sizes to run (default: 64K,1M,4M)\n");
+    fprintf(stderr, "  --pass-windows=SIZE,...    pass windows to run, 0 for one sweep per pass (default: 0,16M)\n");
+    fprintf(stderr, "  --threads=N                workers per file (default: 1)\n");
+    fprintf(stderr, "  --repeat=N                 runs per combination (default: 1)\n");
+    fprintf(stderr, "  --micro-only               only time the pattern, keystream, store and compare kernels\n");
+    fprintf(stderr, "  --no-micro                 skip the kernel micro-benchmarks\n");
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    char* items[BENCH_MAX_ITEMS];
+    int count;
+
+    memset(&config, 0, sizeof(config));
+    config.threads = 1;
+    config.repeat = 1;
+    config.files = 1;
+    config.micro = 1;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int cpu_count = cpus > 0 ? (unsigned int)cpus : 1;
+
+    static const struct option long_options[] = {
+        { "dirs",        required_argument, NULL, 'd' },
+        { "sizes",       required_argument, NULL, 'z' },
+        { "algorithms",  required_argument, NULL, 'a' },
+        { "backends",    required_argument, NULL, 'b' },
+        { "block-sizes", required_argument, NULL, 's' },
+        { "pass-windows", required_argument, NULL, 'w' },
+        { "threads",     required_argument, NULL, 't' },
+        { "repeat",      required_argument, NULL, 'r' },
+        { "micro-only",  no_argument,       NULL, 'm' },
+        { "no-micro",    no_argument,       NULL, 'n' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (option) {
+            case 'd':
+                if ((count = split_list(optarg, items)) < 0) {
+                    fprintf(stderr, "Error: Too many directories.\n");
+                    return EXIT_FAILURE;
+                }
+                config.dir_count = 0;
+                for (int i = 0; i < count; i++) {
+                    config.dirs[config.dir_count++] = items[i];
+                }
+                break;
+            case 'z':
+            case 's':
+                if ((count = split_list(optarg, items)) < 0) {
+                    fprintf(stderr, "Error: Too many sizes.\n");
+                    return EXIT_FAILURE;
+                }
+                size_t* sizes = option == 'z' ? config.sizes : config.block_sizes;
+                size_t* size_count = option == 'z' ? &config.size_count : &config.block_size_count;
+                *size_count = 0;
+                for (int i = 0; i < count; i++) {
+                    if (shred_parse_size(items[i], &sizes[(*size_count)++]) != 0) {
+                        fprintf(stderr, "Error: Invalid size specified.\n");
+                        return EXIT_FAILURE;
+                    }
+                }
+                break;
+            case 'a':
+                if ((count = split_list(optarg, items)) < 0) {
+                    fprintf(stderr, "Error: Too many algorithms.\n");
+                    return EXIT_FAILURE;
+                }
+                config.algorithm_count = 0;
+                for (int i = 0; i < count; i++) {
+                    if (shred_algorithm_from_name(items[i], &config.algorithms[config.algorithm_count++]) != 0) {
+                        fprintf(stderr, "Error: Invalid algorithm specified.\n");
+                        return EXIT_FAILURE;
+                    }
+                }
+                break;
+            case 'b':
+                if ((count = split_list(optarg, items)) < 0) {
+                    fprintf(stderr, "Error: Too many backends.\n");
+                    return EXIT_FAILURE;
+                }
+                config.backend_count = 0;
+                for (int i = 0; i < count; i++) {
+                    if (shred_backend_from_name(items[i], &config.backends[config.backend_count++]) != 0) {
+                        fprintf(stderr, "Error: Invalid backend specified.\n");
+                        return EXIT_FAILURE;
+                    }
+                }
+                break;
+            case 'w':
+                if ((count = split_list(optarg, items)) < 0) {
+                    fprintf(stderr, "Error: Too many pass windows.\n");
+                    return EXIT_FAILURE;
+                }
+                config.pass_window_count = 0;
+                for (int i = 0; i < count; i++) {
+                    size_t* window = &config.pass_windows[config.pass_window_count++];
+                    if (strcmp(items[i], "0") == 0) {
+                        *window = 0;
+                    } else if (shred_parse_size(items[i], window) != 0) {
+                        fprintf(stderr, "Error: Invalid pass window specified.\n");
+                        return EXIT_FAILURE;
+                    }
+                }
+                break;
+            case 't':
+                if (shred_parse_count(optarg, cpu_count * SHRED_MAX_THREADS_PER_CPU, &config.threads) != 0) {
+                    fprintf(stderr, "Error: Thread count must be between 1 and %u.\n",
+                            cpu_count * SHRED_MAX_THREADS_PER_CPU);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                if (shred_parse_count(optarg, UINT_MAX, &config.repeat) != 0) {
+                    fprintf(stderr, "Error: Invalid repeat count specified.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'm':
+                config.files = 0;
+                break;
+            case 'n':
+                config.micro = 0;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // tmpfs shows the CPU cost of the passes, the working directory what
+    // the disk behind it sustains
+    if (config.dir_count == 0) {
+        if (access("/dev/shm", W_OK) == 0) {
+            config.dirs[config.dir_count++] = "/dev/shm";
+        }
+        config.dirs[config.dir_count++] = ".";
+    }
+    if (config.size_count == 0) {
+        config.sizes[config.size_count++] = 1024 * 1024;
+        config.sizes[config.size_count++] = 64 * 1024 * 1024;
+    }
+    if (config.algorithm_count == 0) {
+        for (int i = SHRED_ALGORITHM_NULL_BYTES; i <= SHRED_ALGORITHM_POLYMORPHIC_12_PASS; i++) {
+            config.algorithms[config.algorithm_count++] = (ShredAlgorithm)i;
+        }
+    }
+    if (config.backend_count == 0) {
+        for (int i = SHRED_BACKEND_STDIO; i <= SHRED_BACKEND_MMAP; i++) {
+            config.backends[config.backend_count++] = (ShredBackend)i;
+        }
+    }
+    if (config.block_size_count == 0) {
+        config.block_sizes[config.block_size_count++] = 64 * 1024;
+        config.block_sizes[config.block_size_count++] = 1024 * 1024;
+        config.block_sizes[config.block_size_count++] = 4 * 1024 * 1024;
+    }
+    if (config.pass_window_count == 0) {
+        config.pass_windows[config.pass_window_count++] = 0;
+        config.pass_windows[config.pass_window_count++] = 16 * 1024 * 1024;
+    }
+
+    printf("{\n  \"version\": 1,\n  \"cpus\": %ld,\n  \"cipher\": \"%s\",\n",
+           sysconf(_SC_NPROCESSORS_ONLN), shred_cipher_name(shred_cipher_resolve(SHRED_CIPHER_AUTO)));
+    if (config.files) {
+        run_files(&config);
+        printf("%s\n", config.micro ? "," : "");
+    }
+    if (config.micro) {
+        if (run_micro() != 0) {
+            fprintf(stderr, "Error: Unable to allocate the benchmark buffers.\n");
+            return EXIT_FAILURE;
+        }
+        printf("\n");
+    }
+    printf("}\n");
+
+    return EXIT_SUCCESS;
+}
@@ -1,253 +1,935 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <pthread.h>
-#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <dirent.h>
-#include <openssl/rand.h>
-#include <CommonCrypto/CommonCrypto.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include "shred_engine.h"
+#include "shred_walk.h"
+#include "shred_batch.h"
+#include "shred_tune.h"
+#include "shred_scrub.h"
+#include "shred_parse.h"
+
+// Files shredded at once inside a directory; each is a thread
+#define CLI_MAX_JOBS 1024
+
+// Paths shredded at once per device in batch mode; far past any queue a
+// disk gains from
+#define CLI_MAX_LANES 64
+
+typedef struct {
+    const char* algorithm;
+    ShredAlgorithm shred_algorithm;
+    ShredOptions options;
+    unsigned int jobs;
+    int device;  // wipe disks and disk images in place
+    int batch;   // read the paths from stdin or the manifest
+    const char* manifest;
+    unsigned int lanes;  // per device in batch mode, 0 picks them per device
+    const char* stats_path;  // JSON instrumentation, "-" for stdout
+    double stats_interval;   // seconds between dumps, 0 for only the final one
+    const char* journal_path;  // checkpoints of a single file or disk
+    int resume;                // continue from the journal instead of starting over
+    ShredThrottleLimits limits;  // I/O limits given on the command line
+    const char* throttle_path;   // control file that replaces them at run time
+    ShredTuneMode tune;          // calibrate backend, block size and queue depth per device
+    const char* tune_profile;    // where calibrations are kept, NULL to keep none
+    int tuned_by_hand;           // one of them was given on the command line
+} CliConfig;
+
+// Batches the pass barriers of files shredded at the same time
+static ShredCommitGroup commit_group;
+
+static ShredJournal journal;
+
+// Limits every job is held to, and the control file they are reloaded
+// from while the reporter runs
+static struct {
+    ShredThrottle throttle;
+    ShredThrottleLimits defaults;  // from the command line, for settings the file leaves out
+    const char* path;
+    struct stat seen;              // the file as last read
+    int loaded;
+} throttle_control;
+
+// Set by SIGHUP to reread the control file even if it looks unchanged
+static volatile sig_atomic_t throttle_reload;
+
+static void request_throttle_reload(int signal_number) {
+    (void)signal_number;
+    throttle_reload = 1;
+}
 
-#define BUFFER_SIZE 1024
+// A limit in the control file: a count, or bytes with sizes set; 0 or
+// "off" lifts it
+static int parse_limit(const char* text, int sizes, double* value) {
+    if (strcmp(text, "off") == 0 || strcmp(text, "0") == 0) {
+        *value = 0.0;
+        return 0;
+    }
 
-static void generate_random_iv(unsigned char *iv) {
-    // Generate a random initialization vector
-    if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) {
-        fprintf(stderr, "Error generating random IV.\n");
-        exit(EXIT_FAILURE);
+    if (sizes) {
+        size_t bytes;
+        if (shred_parse_size(text, &bytes) != 0) {
+            return -1;
+        }
+        *value = (double)bytes;
+        return 0;
     }
+
+    return shred_parse_number(text, value) != 0 || *value < 0.0 ? -1 : 0;
 }
 
-static void overwrite_with_polymorphic_12_pass(FILE* fp, long file_size, double* progress) {
-    // 12-pass algorithm with a strong cryptographic stream cipher and dynamic IVs
-    unsigned char key[EVP_MAX_KEY_LENGTH];
-    unsigned char iv[EVP_MAX_IV_LENGTH];
+// Parses the whitespace-separated key=value settings of the control file
+// over the command line limits
+static int parse_throttle_file(char* text, ShredThrottleLimits* limits) {
+    *limits = throttle_control.defaults;
 
-    // Generate a random key for the stream cipher
-    if (RAND_bytes(key, EVP_MAX_KEY_LENGTH) != 1) {
-        fprintf(stderr, "Error generating random key.\n");
-        exit(EXIT_FAILURE);
+    for (char* setting = strtok(text, " \t\r\n"); setting; setting = strtok(NULL, " \t\r\n")) {
+        char* value = strchr(setting, '=');
+        if (!value) {
+            return -1;
+        }
+        *value++ = '\0';
+
+        int status;
+        if (strcmp(setting, "rate") == 0) {
+            status = parse_limit(value, 1, &limits->bytes_per_second);
+        } else if (strcmp(setting, "iops") == 0) {
+            status = parse_limit(value, 0, &limits->ops_per_second);
+        } else if (strcmp(setting, "job-rate") == 0) {
+            status = parse_limit(value, 1, &limits->job_bytes_per_second);
+        } else if (strcmp(setting, "job-iops") == 0) {
+            status = parse_limit(value, 0, &limits->job_ops_per_second);
+        } else if (strcmp(setting, "latency") == 0) {
+            status = parse_limit(value, 0, &limits->latency_target);
+            limits->latency_target /= 1000.0;
+        } else {
+            status = -1;
+        }
+        if (status != 0) {
+            return -1;
+        }
     }
 
-    fseek(fp, 0, SEEK_SET);
-    long num_iterations = file_size / BUFFER_SIZE;
-    long remainder = file_size % BUFFER_SIZE;
+    return 0;
+}
 
-    for (int pass = 0; pass < 12; pass++) {
-        // Generate a new IV for each pass
-        generate_random_iv(iv);
-        fseek(fp, 0, SEEK_SET);
+// Applies the control file when it changed since it was last read, or
+// always with force. A file that goes away leaves the limits as they are.
+static void reload_throttle_file(int force) {
+    struct stat st;
+    if (stat(throttle_control.path, &st) != 0) {
+        return;
+    }
+    if (!force && throttle_control.loaded && st.st_ino == throttle_control.seen.st_ino &&
+        st.st_mtime == throttle_control.seen.st_mtime && st.st_size == throttle_control.seen.st_size) {
+        return;
+    }
+    throttle_control.seen = st;
+    throttle_control.loaded = 1;
 
-        for (long i = 0; i < num_iterations; i++) {
-            unsigned char buffer[BUFFER_SIZE];
+    FILE* fp = fopen(throttle_control.path, "r");
+    if (!fp) {
+        return;
+    }
+    char text[4096];
+    size_t length = fread(text, 1, sizeof(text) - 1, fp);
+    text[length] = '\0';
+    fclose(fp);
+
+    ShredThrottleLimits limits;
+    if (parse_throttle_file(text, &limits) != 0) {
+        fprintf(stderr, "Error: Ignoring the throttle file %s, which has an invalid setting.\n",
+                throttle_control.path);
+        return;
+    }
+    shred_throttle_set(&throttle_control.throttle, &limits);
+}
 
-            // Read data from the file
-            fread(buffer, sizeof(char), BUFFER_SIZE, fp);
+// Summed over every file, for the batch summary
+static struct {
+    atomic_ullong bytes_written;
+} totals;
+
+// Redraws a progress line on the terminal and dumps the stats while the
+// workers run
+typedef struct {
+    ShredProgress progress;
+    ShredStats stats;
+    FILE* stats_file;
+    double stats_interval;
+    int show_progress;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int running;
+} CliReporter;
+
+static CliReporter reporter = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+static void* reporter_main(void* arg) {
+    (void)arg;
+    ShredProgressSample sample;
+    memset(&sample, 0, sizeof(sample));
+    double next_dump = shred_io_now() + reporter.stats_interval;
+
+    pthread_mutex_lock(&reporter.lock);
+    while (reporter.running) {
+        if (throttle_control.path) {
+            int force = throttle_reload;
+            throttle_reload = 0;
+            reload_throttle_file(force);
+        }
 
-            // Encrypt the data using the stream cipher with the current IV
-            EVP_CIPHER_CTX *ctx;
-            int outlen, tmplen;
-            unsigned char ciphertext[BUFFER_SIZE];
+        if (reporter.stats_interval > 0.0 && shred_io_now() >= next_dump) {
+            shred_stats_write_json(&reporter.stats, reporter.stats_file, 0);
+            next_dump += reporter.stats_interval;
+        }
 
-            ctx = EVP_CIPHER_CTX_new();
-            EVP_EncryptInit_ex(ctx, EVP_aes_256_ctr(), NULL, key, iv);
-            EVP_EncryptUpdate(ctx, ciphertext, &outlen, buffer, BUFFER_SIZE);
-            EVP_EncryptFinal_ex(ctx, ciphertext + outlen, &tmplen);
-            EVP_CIPHER_CTX_free(ctx);
+        shred_progress_sample(&reporter.progress, &sample);
+        if (reporter.show_progress && sample.bytes_total > 0) {
+            char text[128];
+            shred_progress_format(&sample, text, sizeof(text));
+            // Leave the cursor at the start so regular output overwrites it
+            fprintf(stderr, "\033[K%s\r", text);
+        }
 
-            // Write the encrypted data back to the file
-            fseek(fp, -BUFFER_SIZE, SEEK_CUR);
-            fwrite(ciphertext, sizeof(char), BUFFER_SIZE, fp);
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += SHRED_PROGRESS_INTERVAL_MS * 1000000L;
+        until.tv_sec += until.tv_nsec / 1000000000L;
+        until.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&reporter.wake, &reporter.lock, &until);
+    }
+    pthread_mutex_unlock(&reporter.lock);
 
-            // Update progress
-            *progress = (double)((pass * num_iterations + i) * BUFFER_SIZE) / (double)(12 * num_iterations * BUFFER_SIZE);
-        }
+    if (reporter.show_progress) {
+        fprintf(stderr, "\033[K");
+    }
+    return NULL;
+}
 
-        if (remainder > 0) {
-            unsigned char buffer[remainder];
+static void stop_reporter(void) {
+    pthread_mutex_lock(&reporter.lock);
+    int running = reporter.running;
+    reporter.running = 0;
+    pthread_cond_signal(&reporter.wake);
+    pthread_mutex_unlock(&reporter.lock);
 
-            // Read remaining data from the file
-            fread(buffer, sizeof(char), remainder, fp);
+    if (running) {
+        pthread_join(reporter.thread, NULL);
+    }
+}
 
-            // Encrypt the remaining data using the stream cipher with the current IV
-            EVP_CIPHER_CTX *ctx;
-            int outlen, tmplen;
-            unsigned char ciphertext[remainder];
+// Runs after the reporter has stopped, also when a failure exits early
+static void write_final_stats(void) {
+    shred_stats_write_json(&reporter.stats, reporter.stats_file, 1);
+    if (reporter.stats_file != stdout) {
+        fclose(reporter.stats_file);
+    }
+}
 
-            ctx = EVP_CIPHER_CTX_new();
-            EVP_EncryptInit_ex(ctx, EVP_aes_256_ctr(), NULL, key, iv);
-            EVP_EncryptUpdate(ctx, ciphertext, &outlen, buffer, remainder);
-            EVP_EncryptFinal_ex(ctx, ciphertext + outlen, &tmplen);
-            EVP_CIPHER_CTX_free(ctx);
+// Only a terminal gets a progress line; periodic stats dumps and the
+// throttle control file need the thread too
+static void start_reporter(CliConfig* config, FILE* stats_file) {
+    if (stats_file) {
+        shred_stats_init(&reporter.stats);
+        reporter.stats_file = stats_file;
+        reporter.stats_interval = config->stats_interval;
+        config->options.stats = &reporter.stats;
+        atexit(write_final_stats);
+    }
 
-            // Write the encrypted data back to the file
-            fseek(fp, -remainder, SEEK_CUR);
-            fwrite(ciphertext, sizeof(char), remainder, fp);
+    reporter.show_progress = isatty(STDERR_FILENO);
+    if (!reporter.show_progress && reporter.stats_interval <= 0.0 && !throttle_control.path) {
+        return;
+    }
 
-            // Update progress
-            *progress = (double)((pass * num_iterations + num_iterations) * BUFFER_SIZE + remainder) / (double)(12 * num_iterations * BUFFER_SIZE);
-        }
+    shred_progress_init(&reporter.progress);
+    reporter.running = 1;
+    if (pthread_create(&reporter.thread, NULL, reporter_main, NULL) != 0) {
+        reporter.running = 0;
+        return;
     }
+
+    config->options.progress = &reporter.progress;
+    atexit(stop_reporter);
 }
 
-void overwrite_with_null_bytes(FILE* fp, long file_size, double* progress) {
-    char null_byte = 0;
+// Picks the backend, block size and queue depth for the device path lives
+// on, unless the command line chose any of them. Without a result the
+// built-in defaults stay.
+static void tune_options(const char* path, CliConfig* config) {
+    if (config->tune == SHRED_TUNE_OFF || config->tuned_by_hand) {
+        return;
+    }
 
-    for (long i = 0; i < file_size; i++) {
-        fwrite(&null_byte, sizeof(char), 1, fp);
+    ShredTuning tuning;
+    if (shred_tune_path(path, config->device, config->tune, config->tune_profile, &tuning) != 0) {
+        return;
+    }
 
-        // Update progress
-        *progress = (double)i / (double)file_size;
+    config->options.backend = tuning.backend;
+    config->options.block_size = tuning.block_size;
+    config->options.queue_depth = tuning.queue_depth;
+    if (!tuning.cached) {
+        printf("Calibrated the device of %s: %s backend, %zu KiB writes", path,
+               shred_backend_name(tuning.backend), tuning.block_size / 1024);
+        if (tuning.backend == SHRED_BACKEND_URING) {
+            printf(", queue depth %u", tuning.queue_depth);
+        }
+        printf(" (%.1f MB/s).\n", tuning.mbps);
     }
 }
 
-void overwrite_with_random_data(FILE* fp, long file_size, double* progress) {
-    char buffer[BUFFER_SIZE];
-    for (int i = 0; i < BUFFER_SIZE; i++) {
-        buffer[i] = rand() % 256; // Generate random data (0-255)
+static void print_verify_report(const char* filename, const ShredVerifyReport* report) {
+    if (report->units_mismatched > 0) {
+        fprintf(stderr, "Error: Verification of %s failed: %llu of %llu checked units differ, first at offset %lld.\n",
+                filename, (unsigned long long)report->units_mismatched,
+                (unsigned long long)report->units_checked, (long long)report->first_mismatch);
+        return;
     }
 
-    fseek(fp, 0, SEEK_SET);
-    long num_iterations = file_size / BUFFER_SIZE;
-    long remainder = file_size % BUFFER_SIZE;
+    printf("Verified %s (%s): %llu of %llu units read back (%.1f MB) in %.3f s, no mismatches",
+           filename, shred_verify_mode_name(report->mode),
+           (unsigned long long)report->units_checked, (unsigned long long)report->units_total,
+           (double)report->bytes_checked / 1e6, report->seconds);
+    if (report->units_checked < report->units_total) {
+        printf("; with 95%% confidence fewer than %.2f%% of units differ",
+               100.0 * shred_verify_confidence_bound(report));
+    }
+    printf(".\n");
+}
 
-    for (long i = 0; i < num_iterations; i++) {
-        fwrite(buffer, sizeof(char), BUFFER_SIZE, fp);
+// Runs the passes over a file or disk (name inside dirfd, filename for
+// messages) and prints what happened
+static int overwrite_at(int dirfd, const char* name, const char* filename, const CliConfig* config) {
+    ShredResult result = {0};
+    if (shred_path_at(dirfd, name, config->shred_algorithm, &config->options, &result) != 0) {
+        if (errno == EBUSY) {
+            fprintf(stderr, "Error: %s is mounted or in use.\n", filename);
+        } else if (errno == ESTALE) {
+            fprintf(stderr, "Error: The journal belongs to another file, size or algorithm than %s.\n", filename);
+        } else if (result.verify.units_mismatched > 0) {
+            print_verify_report(filename, &result.verify);
+        } else {
+            fprintf(stderr, "Error: Unable to overwrite the file %s.\n", filename);
+        }
+        return -1;
+    }
 
-        // Update progress
-        *progress = (double)(i * BUFFER_SIZE) / (double)file_size;
+    atomic_fetch_add(&totals.bytes_written, result.bytes_written);
+    if (config->options.discard == SHRED_DISCARD_ONLY) {
+        printf("%s has been discarded without overwriting.\n", filename);
+    } else {
+        printf("%s has been securely shredded using %s algorithm.\n", filename, config->algorithm);
+        printf("Wrote %llu bytes in %.3f s (%.1f MB/s, %s backend).\n",
+               (unsigned long long)result.bytes_written, result.seconds,
+               shred_result_mbps(&result), shred_backend_name(config->options.backend));
+    }
+    if (config->options.discard != SHRED_DISCARD_NONE) {
+        // Nothing released with no error only means there was nothing to release
+        if (result.bytes_discarded > 0) {
+            printf("Released %llu bytes to the device.\n", (unsigned long long)result.bytes_discarded);
+        }
+        if (result.discard_error == EOPNOTSUPP) {
+            printf("Discard is not supported for %s.\n", filename);
+        } else if (result.discard_error != 0) {
+            printf("Discard of %s stopped early: %s.\n", filename, strerror(result.discard_error));
+        }
+    }
+    if (result.bytes_skipped > 0) {
+        printf("Skipped %llu bytes of holes.\n", (unsigned long long)result.bytes_skipped);
+    }
+    if (config->options.verify != SHRED_VERIFY_NONE) {
+        print_verify_report(filename, &result.verify);
     }
+    return 0;
+}
+
+static int overwrite_path(const char* filename, const CliConfig* config) {
+    return overwrite_at(AT_FDCWD, filename, filename, config);
+}
+
+// Overwrites one regular file inside the directory open as dirfd for the
+// walk, which scrubs and unlinks it afterwards in batches
+static int overwrite_file_at(int dirfd, const char* name, const char* filename, void* user_data) {
+    return overwrite_at(dirfd, name, filename, user_data);
+}
 
-    if (remainder > 0) {
-        fwrite(buffer, sizeof(char), remainder, fp);
+// Shreds a single file, scrubs its name and metadata and deletes it,
+// reporting errors instead of exiting
+static int shred_single_file(const char* filename, const CliConfig* config) {
+    if (overwrite_path(filename, config) != 0) {
+        return -1;
+    }
 
-        // Update progress
-        *progress = (double)(file_size - remainder) / (double)file_size;
+    // Failures are reported by the scrub
+    if (shred_scrub_file(AT_FDCWD, filename) != 0) {
+        return -1;
     }
+
+    printf("%s has been securely shredded and deleted.\n", filename);
+    return 0;
 }
 
-void overwrite_with_gutmann(FILE* fp, long file_size, double* progress) {
-    // Gutmann 35-pass overwrite patterns
-    unsigned char patterns[35][BUFFER_SIZE];
+// Shreds a file, directory or (with --device) disk, reporting errors
+// instead of exiting
+static int shred_entry(const char* filename, void* user_data) {
+    const CliConfig* config = user_data;
+    struct stat st;
+
+    if (lstat(filename, &st) != 0) {
+        fprintf(stderr, "Error: Unable to access the file/directory %s.\n", filename);
+        return -1;
+    }
 
-    for (int i = 0; i < 35; i++) {
-        for (int j = 0; j < BUFFER_SIZE; j++) {
-            patterns[i][j] = i;
+    int disk = S_ISBLK(st.st_mode);
+#ifdef __APPLE__
+    disk = disk || S_ISCHR(st.st_mode);
+#endif
+    if (config->device && (disk || S_ISREG(st.st_mode))) {
+        // Wipe the whole disk or image; it is kept
+        if (overwrite_path(filename, config) != 0) {
+            return -1;
         }
+        printf("%s has been wiped.\n", filename);
+    } else if (disk) {
+        fprintf(stderr, "Error: %s is a disk; pass --device to wipe all of it.\n", filename);
+        return -1;
+    } else if (S_ISREG(st.st_mode)) {
+        // Shred an individual file
+        return shred_single_file(filename, config);
+    } else if (S_ISDIR(st.st_mode)) {
+        // Shred a directory (including all files and subdirectories)
+        ShredWalkStats stats = {0};
+        if (shred_walk(filename, config->jobs, overwrite_file_at, user_data, &stats) != 0) {
+            if (stats.failures == 0) {
+                fprintf(stderr, "Error: Unable to shred the directory %s.\n", filename);
+            } else {
+                fprintf(stderr, "Error: %llu entries in %s could not be shredded.\n",
+                        (unsigned long long)stats.failures, filename);
+            }
+            return -1;
+        }
+
+        printf("Directory %s has been securely shredded using %s algorithm (%llu files, %llu directories removed).\n",
+               filename, config->algorithm,
+               (unsigned long long)stats.files, (unsigned long long)stats.directories);
+    } else {
+        fprintf(stderr, "Error: Unsupported file type: %s.\n", filename);
+        return -1;
     }
 
-    fseek(fp, 0, SEEK_SET);
-    long num_iterations = file_size / (35 * BUFFER_SIZE);
-    long remainder = file_size % (35 * BUFFER_SIZE);
+    return 0;
+}
+
+void shred_file(const char* filename, const CliConfig* config) {
+    if (shred_entry(filename, (void*)config) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
 
-    for (long i = 0; i < num_iterations; i++) {
-        for (int j = 0; j < 35; j++) {
-            fwrite(patterns[j], sizeof(char), BUFFER_SIZE, fp);
+// Reads the whole path list, NUL-separated, from fp
+static char* read_list(FILE* fp, size_t* length) {
+    size_t capacity = 64 * 1024;
+    char* text = malloc(capacity + 1);
+
+    *length = 0;
+    while (text) {
+        size_t got = fread(text + *length, 1, capacity - *length, fp);
+        *length += got;
+        if (got == 0) {
+            break;
         }
+        if (*length == capacity) {
+            capacity *= 2;
+            char* larger = realloc(text, capacity + 1);
+            if (!larger) {
+                free(text);
+                return NULL;
+            }
+            text = larger;
+        }
+    }
 
-        // Update progress
-        *progress = (double)(i * 35 * BUFFER_SIZE) / (double)file_size;
+    if (text && ferror(fp)) {
+        free(text);
+        return NULL;
     }
+    return text;
+}
 
-    if (remainder > 0) {
-        for (int j = 0; j < 35; j++) {
-            fwrite(patterns[j], sizeof(char), remainder, fp);
+// The config tuned for each device of a batch
+typedef struct {
+    dev_t dev;
+    CliConfig config;
+} TunedDevice;
+
+static struct {
+    TunedDevice* devices;
+    size_t count;
+} tuned;
+
+// Calibrates every device the paths live on before any of them is
+// shredded, so the probes do not compete with the lanes
+static void tune_devices(char* const* paths, size_t count, const CliConfig* config) {
+    if (config->tune == SHRED_TUNE_OFF || config->tuned_by_hand) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct stat st;
+        if (lstat(paths[i], &st) != 0) {
+            continue;
+        }
+
+        dev_t dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+        size_t d = 0;
+        while (d < tuned.count && tuned.devices[d].dev != dev) {
+            d++;
+        }
+        if (d < tuned.count) {
+            continue;
         }
 
-        // Update progress
-        *progress = (double)(file_size - remainder) / (double)file_size;
+        TunedDevice* larger = realloc(tuned.devices, (tuned.count + 1) * sizeof(TunedDevice));
+        if (!larger) {
+            return;
+        }
+        tuned.devices = larger;
+        tuned.devices[tuned.count].dev = dev;
+        tuned.devices[tuned.count].config = *config;
+        tune_options(paths[i], &tuned.devices[tuned.count].config);
+        tuned.count++;
     }
 }
 
-void shred_file(const char* filename, const char* algorithm) {
+// shred_entry with the settings tuned for the path's device
+static int shred_tuned_entry(const char* filename, void* user_data) {
     struct stat st;
-    if (stat(filename, &st) == 0) {
-        if (S_ISREG(st.st_mode)) {
-            // Shred an individual file
-            FILE* fp = fopen(filename, "r+b");
-
-            if (!fp) {
-                fprintf(stderr, "Error: Unable to open the file.\n");
-                exit(EXIT_FAILURE);
-            }
 
-            fseek(fp, 0, SEEK_END);
-            long file_size = ftell(fp);
-            rewind(fp);
-
-            double progress = 0.0;
-            if (strcmp(algorithm, "nullbytes") == 0) {
-                overwrite_with_null_bytes(fp, file_size, &progress);
-            } else if (strcmp(algorithm, "randomdata") == 0) {
-                overwrite_with_random_data(fp, file_size, &progress);
-            } else if (strcmp(algorithm, "gutmann") == 0) {
-                overwrite_with_gutmann(fp, file_size, &progress);
-            } else if (strcmp(algorithm, "polymorphic") == 0) {
-                overwrite_with_polymorphic_12_pass(fp, file_size, &progress);
-            } else {
-                fprintf(stderr, "Error: Invalid algorithm specified.\n");
-                exit(EXIT_FAILURE);
+    if (lstat(filename, &st) == 0) {
+        dev_t dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+        for (size_t d = 0; d < tuned.count; d++) {
+            if (tuned.devices[d].dev == dev) {
+                return shred_entry(filename, &tuned.devices[d].config);
             }
+        }
+    }
+    return shred_entry(filename, user_data);
+}
 
-            fclose(fp);
-            printf("%s has been securely shredded using %s algorithm.\n", filename, algorithm);
-            
-             // Delete the file after shredding
-            if (remove(filename) == 0) {
-                printf("%s has been securely shredded and deleted.\n", filename);
-            } else {
-                fprintf(stderr, "Error: Unable to delete the file.\n");
-                exit(EXIT_FAILURE);
+// Shreds every path of the list, device by device, and prints one summary
+static int shred_batch_list(const char* manifest, CliConfig* config) {
+    FILE* fp = manifest ? fopen(manifest, "rb") : stdin;
+    if (!fp) {
+        fprintf(stderr, "Error: Unable to open the manifest %s.\n", manifest);
+        return -1;
+    }
+
+    size_t length;
+    char* text = read_list(fp, &length);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    if (!text) {
+        fprintf(stderr, "Error: Unable to read the list of paths.\n");
+        return -1;
+    }
+
+    size_t count;
+    errno = 0;
+    char** paths = shred_batch_split(text, length, &count);
+    if (!paths && errno == ENOMEM) {
+        free(text);
+        fprintf(stderr, "Error: Out of memory.\n");
+        return -1;
+    }
+
+    tune_devices(paths, count, config);
+
+    ShredBatchStats stats;
+    int status = shred_batch(paths, count, config->lanes, shred_tuned_entry, config, &stats);
+
+    uint64_t written = atomic_load(&totals.bytes_written);
+    printf("Batch finished: %llu of %llu paths shredded on %u devices (%u lanes), "
+           "%llu bytes written in %.3f s (%.1f MB/s).\n",
+           (unsigned long long)(stats.paths - stats.failures), (unsigned long long)stats.paths,
+           stats.devices, stats.lanes, (unsigned long long)written, stats.seconds,
+           stats.seconds > 0.0 ? (double)written / stats.seconds / 1e6 : 0.0);
+    if (stats.failures > 0) {
+        fprintf(stderr, "Error: %llu paths could not be shredded.\n", (unsigned long long)stats.failures);
+    }
+
+    free(paths);
+    free(text);
+    free(tuned.devices);
+    return status;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [options] <filename/directory> <algorithm>\n", program);
+    fprintf(stderr, "       %s [options] --batch|--manifest=FILE <algorithm>\n", program);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --batch                              shred the NUL-separated paths read from stdin (find -print0)\n");
+    fprintf(stderr, "  --manifest=FILE                      shred the NUL-separated paths listed in FILE\n");
+    fprintf(stderr, "  --lanes=N                            paths shredded at once per device in batch mode (default: 1 on\n");
+    fprintf(stderr, "                                       rotational disks, 4 on flash)\n");
+    fprintf(stderr, "  --backend=NAME                       I/O path used for the passes: stdio, pwrite, direct, uring\n");
+    fprintf(stderr, "                                       or mmap (default pwrite)\n");
+    fprintf(stderr, "  --block-size=BYTES                   size of each write, K/M/G suffixes allowed (default 4M)\n");
+    fprintf(stderr, "  --queue-depth=N                      writes kept in flight by the uring backend (default 8)\n");
+    fprintf(stderr, "  --tune=off|profile|auto|fresh        pick backend, block size and queue depth per device from\n");
+    fprintf(stderr, "                                       the profile, calibrating unknown devices (default auto)\n");
+    fprintf(stderr, "  --tune-profile=FILE                  where calibrations are kept (default ~/" SHRED_TUNE_PROFILE_NAME ")\n");
+    fprintf(stderr, "  --cipher=auto|aes|chacha20           keystream for random passes (default: AES if the CPU has AES instructions)\n");
+    fprintf(stderr, "  --verify=none|sample|full            read back the final pass after writing it (default none)\n");
+    fprintf(stderr, "  --sample-rate=PERCENT                share of the file read back by --verify=sample (default 1)\n");
+    fprintf(stderr, "  --device                             wipe a whole block device or disk image in place\n");
+    fprintf(stderr, "  --discard=none|after|only            release the blocks after the passes, or instead of them (default none)\n");
+    fprintf(stderr, "  --pass-barrier                       make every pass durable before the next one starts, batching\n");
+    fprintf(stderr, "                                       the syncs of files shredded together\n");
+    fprintf(stderr, "  --pass-window=BYTES                  run every pass over one window of BYTES before the next, each\n");
+    fprintf(stderr, "                                       pass forced to the device (default: one sweep per pass)\n");
+    fprintf(stderr, "  --journal=FILE                       checkpoint the passes over a single file or disk to FILE\n");
+    fprintf(stderr, "  --resume                             continue from the last checkpoint in the --journal FILE\n");
+    fprintf(stderr, "  --max-rate=BYTES                     bytes written and read per second over all files, K/M/G\n");
+    fprintf(stderr, "                                       suffixes allowed (default: unlimited)\n");
+    fprintf(stderr, "  --max-iops=N                         I/O calls per second over all files (default: unlimited)\n");
+    fprintf(stderr, "  --job-max-rate=BYTES                 bytes per second for each file on its own\n");
+    fprintf(stderr, "  --job-max-iops=N                     I/O calls per second for each file on its own\n");
+    fprintf(stderr, "  --adaptive-latency=MS                lower the rate while writes take longer than MS on average\n");
+    fprintf(stderr, "  --throttle-file=FILE                 reload the limits from FILE when it changes or on SIGHUP\n");
+    fprintf(stderr, "  --skip-holes                         only overwrite the allocated extents of sparse files\n");
+    fprintf(stderr, "  --threads=N                          workers per file, each on its own byte range (default 1)\n");
+    fprintf(stderr, "  --jobs=N                             files shredded concurrently inside a directory (default: CPU count)\n");
+    fprintf(stderr, "  --stats=FILE                         write per-pass timings, byte and syscall counts and I/O\n");
+    fprintf(stderr, "                                       latency histograms to FILE (- for stdout) as JSON\n");
+    fprintf(stderr, "  --stats-interval=SECONDS             also write a snapshot every SECONDS while shredding\n");
+}
+
+int main(int argc, char* argv[]) {
+    static const struct option long_options[] = {
+        { "backend",     required_argument, NULL, 'b' },
+        { "block-size",  required_argument, NULL, 's' },
+        { "queue-depth", required_argument, NULL, 'q' },
+        { "tune",        required_argument, NULL, 'u' },
+        { "tune-profile", required_argument, NULL, 'p' },
+        { "cipher",      required_argument, NULL, 'c' },
+        { "verify",      required_argument, NULL, 'v' },
+        { "sample-rate", required_argument, NULL, 'r' },
+        { "batch",       no_argument,       NULL, 'B' },
+        { "manifest",    required_argument, NULL, 'm' },
+        { "lanes",       required_argument, NULL, 'l' },
+        { "stats",       required_argument, NULL, 'S' },
+        { "stats-interval", required_argument, NULL, 'I' },
+        { "device",      no_argument,       NULL, 'D' },
+        { "pass-barrier", no_argument,      NULL, 'P' },
+        { "pass-window", required_argument, NULL, 'W' },
+        { "journal",     required_argument, NULL, 'J' },
+        { "resume",      no_argument,       NULL, 'R' },
+        { "max-rate",    required_argument, NULL, 'M' },
+        { "max-iops",    required_argument, NULL, 'O' },
+        { "job-max-rate", required_argument, NULL, 'x' },
+        { "job-max-iops", required_argument, NULL, 'o' },
+        { "adaptive-latency", required_argument, NULL, 'L' },
+        { "throttle-file", required_argument, NULL, 'T' },
+        { "discard",     required_argument, NULL, 'd' },
+        { "skip-holes",  no_argument,       NULL, 'H' },
+        { "threads",     required_argument, NULL, 't' },
+        { "jobs",        required_argument, NULL, 'j' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    CliConfig config;
+    memset(&config, 0, sizeof(config));
+    shred_options_init(&config.options);
+    config.tune = SHRED_TUNE_AUTO;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int cpu_count = cpus > 0 ? (unsigned int)cpus : 1;
+    config.jobs = cpu_count;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'b':
+                if (shred_backend_from_name(optarg, &config.options.backend) != 0) {
+                    fprintf(stderr, "Error: Invalid backend specified.\n");
+                    return EXIT_FAILURE;
+                }
+                config.tuned_by_hand = 1;
+                break;
+            case 's':
+                if (shred_parse_size(optarg, &config.options.block_size) != 0) {
+                    fprintf(stderr, "Error: Invalid block size specified.\n");
+                    return EXIT_FAILURE;
+                }
+                config.tuned_by_hand = 1;
+                break;
+            case 'q':
+                if (shred_parse_count(optarg, SHRED_MAX_QUEUE_DEPTH, &config.options.queue_depth) != 0) {
+                    fprintf(stderr, "Error: Queue depth must be between 1 and %d.\n", SHRED_MAX_QUEUE_DEPTH);
+                    return EXIT_FAILURE;
+                }
+                config.tuned_by_hand = 1;
+                break;
+            case 'u':
+                if (shred_tune_mode_from_name(optarg, &config.tune) != 0) {
+                    fprintf(stderr, "Error: Invalid tuning mode specified.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'p':
+                config.tune_profile = optarg;
+                break;
+            case 'c':
+                if (shred_cipher_from_name(optarg, &config.options.cipher) != 0) {
+                    fprintf(stderr, "Error: Invalid cipher specified.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'v':
+                if (shred_verify_mode_from_name(optarg, &config.options.verify) != 0) {
+                    fprintf(stderr, "Error: Invalid verification mode specified.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                if (shred_parse_number(optarg, &config.options.sample_rate) != 0) {
+                    fprintf(stderr, "Error: Invalid sample rate specified.\n");
+                    return EXIT_FAILURE;
+                }
+                config.options.sample_rate /= 100.0;
+                if (config.options.sample_rate <= 0.0 || config.options.sample_rate > 1.0) {
+                    fprintf(stderr, "Error: Sample rate must be between 0 and 100 percent.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'B':
+                config.batch = 1;
+                break;
+            case 'm':
+                config.batch = 1;
+                config.manifest = optarg;
+                break;
+            case 'l':
+                if (shred_parse_count(optarg, CLI_MAX_LANES, &config.lanes) != 0) {
+                    fprintf(stderr, "Error: Lane count must be between 1 and %d.\n", CLI_MAX_LANES);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'S':
+                config.stats_path = optarg;
+                break;
+            case 'I':
+                if (shred_parse_number(optarg, &config.stats_interval) != 0 || config.stats_interval <= 0.0) {
+                    fprintf(stderr, "Error: Invalid stats interval specified.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'P':
+                config.options.pass_barrier = 1;
+                config.options.commit = &commit_group;
+                break;
+            case 'W':
+                if (shred_parse_size(optarg, &config.options.pass_window) != 0) {
+                    fprintf(stderr, "Error: Invalid pass window specified.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'J':
+                config.journal_path = optarg;
+                break;
+            case 'R':
+                config.resume = 1;
+                break;
+            case 'M':
+            case 'x': {
+                size_t rate;
+                if (shred_parse_size(optarg, &rate) != 0) {
+                    fprintf(stderr, "Error: Invalid rate limit specified.\n");
+                    return EXIT_FAILURE;
+                }
+                *(opt == 'M' ? &config.limits.bytes_per_second : &config.limits.job_bytes_per_second) = (double)rate;
+                break;
             }
-            
-        } else if (S_ISDIR(st.st_mode)) {
-            // Shred a directory (including all files and subdirectories)
-            DIR* dir = opendir(filename);
-            if (!dir) {
-                fprintf(stderr, "Error: Unable to open the directory.\n");
-                exit(EXIT_FAILURE);
+            case 'O':
+            case 'o': {
+                double iops;
+                if (shred_parse_number(optarg, &iops) != 0 || iops <= 0.0) {
+                    fprintf(stderr, "Error: Invalid IOPS limit specified.\n");
+                    return EXIT_FAILURE;
+                }
+                *(opt == 'O' ? &config.limits.ops_per_second : &config.limits.job_ops_per_second) = iops;
+                break;
             }
-
-            struct dirent* entry;
-            while ((entry = readdir(dir)) != NULL) {
-                // Skip "." and ".." directories
-                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-                    continue;
+            case 'L':
+                if (shred_parse_number(optarg, &config.limits.latency_target) != 0 ||
+                    config.limits.latency_target <= 0.0) {
+                    fprintf(stderr, "Error: Invalid latency target specified.\n");
+                    return EXIT_FAILURE;
+                }
+                config.limits.latency_target /= 1000.0;
+                break;
+            case 'T':
+                config.throttle_path = optarg;
+                break;
+            case 'D':
+                config.device = 1;
+                break;
+            case 'd':
+                if (shred_discard_mode_from_name(optarg, &config.options.discard) != 0) {
+                    fprintf(stderr, "Error: Invalid discard mode specified.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'H':
+                config.options.skip_holes = 1;
+                break;
+            case 't':
+                if (shred_parse_count(optarg, cpu_count * SHRED_MAX_THREADS_PER_CPU, &config.options.threads) != 0) {
+                    fprintf(stderr, "Error: Thread count must be between 1 and %u.\n",
+                            cpu_count * SHRED_MAX_THREADS_PER_CPU);
+                    return EXIT_FAILURE;
                 }
+                break;
+            case 'j':
+                if (shred_parse_count(optarg, CLI_MAX_JOBS, &config.jobs) != 0) {
+                    fprintf(stderr, "Error: Job count must be between 1 and %d.\n", CLI_MAX_JOBS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != (config.batch ? 1 : 2)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
 
-                // Create the full path for the entry
-                char path[PATH_MAX];
-                snprintf(path, PATH_MAX, "%s/%s", filename, entry->d_name);
+    const char* filename = config.batch ? NULL : argv[optind];
+    config.algorithm = argv[argc - 1];
 
-                // Recursive call to shred_file for the entry
-                shred_file(path, algorithm);
-            }
+    if (shred_algorithm_from_name(config.algorithm, &config.shred_algorithm) != 0) {
+        fprintf(stderr, "Error: Invalid algorithm specified.\n");
+        return EXIT_FAILURE;
+    }
 
-            closedir(dir);
-            printf("Directory %s has been securely shredded using %s algorithm.\n", filename, algorithm);
-        } else {
-            fprintf(stderr, "Error: Unsupported file type.\n");
-            exit(EXIT_FAILURE);
+    if (config.options.discard == SHRED_DISCARD_ONLY && config.options.verify != SHRED_VERIFY_NONE) {
+        fprintf(stderr, "Error: --discard=only writes nothing that --verify could read back.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (config.resume && !config.journal_path) {
+        fprintf(stderr, "Error: --resume needs --journal.\n");
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    if (config.journal_path && (config.batch || (stat(filename, &st) == 0 && S_ISDIR(st.st_mode)))) {
+        fprintf(stderr, "Error: --journal only covers a single file or disk.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (config.journal_path) {
+        if (shred_journal_open(&journal, config.journal_path, config.resume) != 0) {
+            if (errno == EEXIST) {
+                fprintf(stderr, "Error: The journal %s already exists; pass --resume to continue from it.\n",
+                        config.journal_path);
+            } else {
+                fprintf(stderr, "Error: Unable to open the journal %s.\n", config.journal_path);
+            }
+            return EXIT_FAILURE;
         }
-    } else {
-        fprintf(stderr, "Error: Unable to access the file/directory.\n");
-        exit(EXIT_FAILURE);
+        if (shred_journal_done_bytes(&journal) > 0) {
+            printf("Resuming from %s: %llu bytes were already overwritten.\n", config.journal_path,
+                   (unsigned long long)shred_journal_done_bytes(&journal));
+        }
+        config.options.journal = &journal;
     }
-}
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <filename/directory> <algorithm>\n", argv[0]);
+    static char default_profile[PATH_MAX];
+    if (!config.tune_profile && shred_tune_default_profile(default_profile, sizeof(default_profile)) == 0) {
+        config.tune_profile = default_profile;
+    }
+    // Writing the probe to a disk would undo checkpoints of the journal
+    if (config.device && config.options.journal && shred_journal_done_bytes(&journal) > 0 &&
+        config.tune != SHRED_TUNE_OFF) {
+        config.tune = SHRED_TUNE_PROFILE;
+    }
+
+    shred_commit_init(&commit_group);
+
+    // Jobs go through the throttle whenever it could limit them, including
+    // when only the control file may set limits later on
+    if (config.throttle_path || config.limits.bytes_per_second > 0.0 || config.limits.ops_per_second > 0.0 ||
+        config.limits.job_bytes_per_second > 0.0 || config.limits.job_ops_per_second > 0.0 ||
+        config.limits.latency_target > 0.0) {
+        shred_throttle_init(&throttle_control.throttle, &config.limits);
+        throttle_control.defaults = config.limits;
+        config.options.throttle = &throttle_control.throttle;
+    }
+    if (config.throttle_path) {
+        throttle_control.path = config.throttle_path;
+        reload_throttle_file(1);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = request_throttle_reload;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGHUP, &action, NULL);
+    }
+
+    FILE* stats_file = NULL;
+    if (config.stats_path) {
+        stats_file = strcmp(config.stats_path, "-") == 0 ? stdout : fopen(config.stats_path, "w");
+        if (!stats_file) {
+            fprintf(stderr, "Error: Unable to open the stats file %s.\n", config.stats_path);
+            return EXIT_FAILURE;
+        }
+    } else if (config.stats_interval > 0.0) {
+        fprintf(stderr, "Error: --stats-interval needs --stats.\n");
         return EXIT_FAILURE;
     }
 
-    const char* filename = argv[1];
-    const char* algorithm = argv[2];
+    if (!config.batch) {
+        tune_options(filename, &config);
+    }
 
-    shred_file(filename, algorithm);
+    start_reporter(&config, stats_file);
+    if (config.batch) {
+        return shred_batch_list(config.manifest, &config) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    shred_file(filename, &config);
+
+    // Only a failed run leaves its journal behind to resume from. It holds
+    // the job's key and nonces and names the target, so it goes the way of
+    // the target rather than leaving its blocks and name behind.
+    if (config.journal_path) {
+        shred_journal_close(&journal);
+        ShredOptions options;
+        shred_options_init(&options);
+        if (shred_path(config.journal_path, config.shred_algorithm, &options, NULL) != 0 ||
+            shred_scrub_file(AT_FDCWD, config.journal_path) != 0) {
+            fprintf(stderr, "Error: Unable to shred the journal %s.\n", config.journal_path);
+            return EXIT_FAILURE;
+        }
+    }
 
     return EXIT_SUCCESS;
 }
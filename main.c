@@ -41,6 +41,9 @@ static void create_algorithm_dialog(GtkWidget *file_chooser) {
     gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo), "Polymorphic 12-pass"); // Added new algorithm option
     gtk_combo_box_set_active(GTK_COMBO_BOX(combo), 0);
 
+    // Let shred_file find the selected algorithm through the file chooser
+    g_object_set_data(G_OBJECT(file_chooser), "combo", combo);
+
     // Create the "Shred File" button
     button = gtk_button_new_with_label("Shred File");
 
@@ -79,13 +82,16 @@ int main(int argc, char *argv[]) {
     gtk_widget_override_background_color(window, GTK_STATE_NORMAL, &black_color);
 
     // Create the file chooser dialog
-    file_chooser = gtk_file_chooser_dialog_new("Select a file to shred",
+    file_chooser = gtk_file_chooser_dialog_new("Select files to shred",
                                               GTK_WINDOW(window),
                                               GTK_FILE_CHOOSER_ACTION_OPEN,
                                               "Cancel", GTK_RESPONSE_CANCEL,
                                               "Open", GTK_RESPONSE_ACCEPT,
                                               NULL);
 
+    // Several files can be queued at once
+    gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(file_chooser), TRUE);
+
     // Connect the "Open" button clicked signal to create_algorithm_dialog function
     g_signal_connect(file_chooser, "response", G_CALLBACK(create_algorithm_dialog), file_chooser);
 
@@ -95,5 +101,8 @@ int main(int argc, char *argv[]) {
     // Start the GTK main loop
     gtk_main();
 
+    // Stop any shreds still queued or running
+    shredder_shutdown();
+
     return 0;
 }
@@ -0,0 +1,241 @@
+#include "shred_batch.h"
+#include "shred_io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+
+typedef struct {
+    dev_t dev;
+    size_t index;
+} BatchEntry;
+
+// All paths of one device, shared by that device's lanes
+typedef struct {
+    dev_t dev;
+    const BatchEntry* entries;
+    size_t count;
+    atomic_size_t next;
+} BatchDevice;
+
+typedef struct {
+    BatchDevice* device;
+    char* const* paths;
+    ShredBatchFunc shred;
+    void* user_data;
+    atomic_ullong* failures;
+} BatchLane;
+
+char** shred_batch_split(char* text, size_t length, size_t* count) {
+    // NUL-separated when there is any NUL, one path per line otherwise
+    char separator = memchr(text, '\0', length) ? '\0' : '\n';
+    size_t capacity = 0;
+    char** paths = NULL;
+
+    *count = 0;
+    for (size_t start = 0; start < length; ) {
+        char* end = memchr(text + start, separator, length - start);
+        size_t stop = end ? (size_t)(end - text) : length;
+
+        if (stop > start) {
+            if (*count == capacity) {
+                size_t grown = capacity ? capacity * 2 : 256;
+                char** larger = realloc(paths, grown * sizeof(char*));
+                if (!larger) {
+                    free(paths);
+                    *count = 0;
+                    return NULL;
+                }
+                paths = larger;
+                capacity = grown;
+            }
+
+            // The last path may run to the end of the buffer, which the
+            // caller keeps one byte longer for this terminator
+            text[stop] = '\0';
+            paths[(*count)++] = text + start;
+        }
+        start = stop + 1;
+    }
+
+    return paths;
+}
+
+unsigned int shred_batch_device_lanes(dev_t dev) {
+#ifdef __linux__
+    // Partitions keep their queue attributes on the parent disk
+    static const char* formats[] = {
+        "/sys/dev/block/%u:%u/queue/rotational",
+        "/sys/dev/block/%u:%u/../queue/rotational"
+    };
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        char path[128];
+        snprintf(path, sizeof(path), formats[i], major(dev), minor(dev));
+
+        FILE* fp = fopen(path, "r");
+        if (fp) {
+            int rotational = fgetc(fp);
+            fclose(fp);
+            return rotational == '1' ? SHRED_BATCH_ROTATIONAL_LANES : SHRED_BATCH_FLASH_LANES;
+        }
+    }
+#else
+    (void)dev;
+#endif
+
+    // Unknown (network file systems, tmpfs, macOS): be gentle
+    return SHRED_BATCH_ROTATIONAL_LANES;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    const BatchEntry* x = a;
+    const BatchEntry* y = b;
+
+    if (x->dev != y->dev) {
+        return x->dev < y->dev ? -1 : 1;
+    }
+    // Keep the input order within a device
+    return x->index < y->index ? -1 : (x->index > y->index);
+}
+
+static void* lane_main(void* arg) {
+    BatchLane* lane = arg;
+    BatchDevice* device = lane->device;
+
+    for (;;) {
+        size_t next = atomic_fetch_add(&device->next, 1);
+        if (next >= device->count) {
+            return NULL;
+        }
+
+        if (lane->shred(lane->paths[device->entries[next].index], lane->user_data) != 0) {
+            atomic_fetch_add(lane->failures, 1);
+        }
+    }
+}
+
+int shred_batch(char* const* paths, size_t count, unsigned int lanes,
+                ShredBatchFunc shred, void* user_data, ShredBatchStats* stats) {
+    double started = shred_io_now();
+    atomic_ullong failures = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->paths = count;
+
+    BatchEntry* entries = calloc(count ? count : 1, sizeof(BatchEntry));
+    if (!entries) {
+        stats->failures = count;
+        return -1;
+    }
+
+    size_t usable = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct stat st;
+        if (lstat(paths[i], &st) != 0) {
+            fprintf(stderr, "Error: Unable to access %s.\n", paths[i]);
+            atomic_fetch_add(&failures, 1);
+            continue;
+        }
+        // Disk nodes all live on devtmpfs; a disk is its own device
+        int disk = S_ISBLK(st.st_mode);
+#ifdef __APPLE__
+        disk = disk || S_ISCHR(st.st_mode);
+#endif
+        entries[usable].dev = disk ? st.st_rdev : st.st_dev;
+        entries[usable].index = i;
+        usable++;
+    }
+    qsort(entries, usable, sizeof(BatchEntry), compare_entries);
+
+    // One group per device
+    size_t device_count = 0;
+    for (size_t i = 0; i < usable; i++) {
+        if (i == 0 || entries[i].dev != entries[i - 1].dev) {
+            device_count++;
+        }
+    }
+
+    BatchDevice* devices = calloc(device_count ? device_count : 1, sizeof(BatchDevice));
+    unsigned int* device_lanes = calloc(device_count ? device_count : 1, sizeof(unsigned int));
+    if (!devices || !device_lanes) {
+        free(devices);
+        free(device_lanes);
+        free(entries);
+        stats->failures = count;
+        return -1;
+    }
+
+    size_t lane_count = 0;
+    for (size_t i = 0, d = 0; i < usable; d++) {
+        size_t j = i;
+        while (j < usable && entries[j].dev == entries[i].dev) {
+            j++;
+        }
+
+        devices[d].dev = entries[i].dev;
+        devices[d].entries = &entries[i];
+        devices[d].count = j - i;
+        atomic_init(&devices[d].next, 0);
+
+        // Never more lanes than paths on the device
+        unsigned int wanted = lanes ? lanes : shred_batch_device_lanes(entries[i].dev);
+        device_lanes[d] = (size_t)wanted < devices[d].count ? wanted : (unsigned int)devices[d].count;
+        lane_count += device_lanes[d];
+        i = j;
+    }
+
+    BatchLane* lane_args = calloc(lane_count ? lane_count : 1, sizeof(BatchLane));
+    pthread_t* threads = calloc(lane_count ? lane_count : 1, sizeof(pthread_t));
+    size_t started_lanes = 0;
+
+    if (lane_args && threads) {
+        for (size_t d = 0; d < device_count; d++) {
+            for (unsigned int l = 0; l < device_lanes[d]; l++) {
+                BatchLane* lane = &lane_args[started_lanes];
+                lane->device = &devices[d];
+                lane->paths = paths;
+                lane->shred = shred;
+                lane->user_data = user_data;
+                lane->failures = &failures;
+
+                if (pthread_create(&threads[started_lanes], NULL, lane_main, lane) != 0) {
+                    // The device's other lanes (or this thread) pick up the slack
+                    if (l == 0) {
+                        lane_main(lane);
+                    }
+                    break;
+                }
+                started_lanes++;
+            }
+        }
+    } else {
+        // No memory for lanes; shred everything on this thread
+        for (size_t d = 0; d < device_count; d++) {
+            BatchLane lane = { &devices[d], paths, shred, user_data, &failures };
+            lane_main(&lane);
+        }
+    }
+
+    for (size_t i = 0; i < started_lanes; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    stats->failures = atomic_load(&failures);
+    stats->devices = (unsigned int)device_count;
+    stats->lanes = (unsigned int)started_lanes;
+    stats->seconds = shred_io_now() - started;
+
+    free(threads);
+    free(lane_args);
+    free(device_lanes);
+    free(devices);
+    free(entries);
+    return stats->failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,42 @@
+#ifndef SHRED_BATCH_H
+#define SHRED_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Lanes per device when the caller does not choose: one stream per
+// spinning disk, several for flash where queue depth pays off
+#define SHRED_BATCH_ROTATIONAL_LANES 1
+#define SHRED_BATCH_FLASH_LANES 4
+
+// Shreds one path of the batch; returns 0 on success
+typedef int (*ShredBatchFunc)(const char* path, void* user_data);
+
+typedef struct {
+    uint64_t paths;
+    uint64_t failures;
+    unsigned int devices;
+    unsigned int lanes;  // threads across all devices
+    double seconds;
+} ShredBatchStats;
+
+// Parses a list of NUL-separated paths (as written by find -print0) in
+// place; a list without any NUL is taken as one path per line instead.
+// Returns a malloc'd array pointing into text.
+char** shred_batch_split(char* text, size_t length, size_t* count);
+
+// Lanes used for dev when none are requested: rotational disks get
+// SHRED_BATCH_ROTATIONAL_LANES, everything else SHRED_BATCH_FLASH_LANES
+unsigned int shred_batch_device_lanes(dev_t dev);
+
+// Groups the paths by the device they live on (st_dev, or st_rdev for a
+// disk node) and works through
+// each group on its own lanes, lanes threads per device (0 picks them per
+// device), so every disk stays busy and no disk sees more streams than it
+// handles well. Paths that cannot be stat'ed count as failures. Returns 0
+// when every path was shredded, -1 otherwise.
+int shred_batch(char* const* paths, size_t count, unsigned int lanes,
+                ShredBatchFunc shred, void* user_data, ShredBatchStats* stats);
+
+#endif /* SHRED_BATCH_H */
@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include "shred_commit.h"
+#include "shred_io.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// A barrier waiting in a group, on the stack of the thread that asked
+struct ShredCommitMember {
+    int fd;
+    dev_t dev;
+    int device;   // a disk, not a file on a mounted file system
+    int synced;   // handled by the leader
+    int done;     // result published, only read and written under the lock
+    int error;
+    ShredCommitMember* next;
+};
+
+void shred_commit_init(ShredCommitGroup* group) {
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->committed, NULL);
+    group->pending = NULL;
+    group->leader = 0;
+}
+
+void shred_commit_destroy(ShredCommitGroup* group) {
+    pthread_cond_destroy(&group->committed);
+    pthread_mutex_destroy(&group->lock);
+}
+
+static int same_file_system(const ShredCommitMember* a, const ShredCommitMember* b) {
+    return !a->device && !b->device && a->dev == b->dev;
+}
+
+// Writes the dirty pages of every member back to the device, all started
+// before any is waited on. Returns -1 where sync_file_range is missing.
+static int write_back(ShredCommitMember* batch) {
+#if defined(__linux__) && defined(SYNC_FILE_RANGE_WRITE)
+    for (ShredCommitMember* member = batch; member; member = member->next) {
+        shred_io_count_syscalls(1);
+        if (sync_file_range(member->fd, 0, 0, SYNC_FILE_RANGE_WRITE) != 0) {
+            return -1;
+        }
+    }
+    for (ShredCommitMember* member = batch; member; member = member->next) {
+        shred_io_count_syscalls(1);
+        if (sync_file_range(member->fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                                                SYNC_FILE_RANGE_WAIT_AFTER) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+#else
+    (void)batch;
+    return -1;
+#endif
+}
+
+static void commit_batch(ShredCommitMember* batch) {
+    // With every member's data on the device, one fdatasync per file
+    // system commits the journal and ends in the cache flush that makes
+    // all of it durable; the passes overwrite blocks in place, so there
+    // is no other metadata to wait for. Without the write-back every file
+    // is synced on its own.
+    int shared = write_back(batch) == 0;
+
+    for (ShredCommitMember* member = batch; member; member = member->next) {
+        if (member->synced) {
+            continue;
+        }
+
+        member->error = shred_io_sync(member->fd) == 0 ? 0 : errno;
+        member->synced = 1;
+        for (ShredCommitMember* other = member->next; other && shared; other = other->next) {
+            if (!other->synced && same_file_system(member, other)) {
+                other->error = member->error;
+                other->synced = 1;
+            }
+        }
+    }
+}
+
+int shred_commit_sync(ShredCommitGroup* group, int fd) {
+    ShredCommitMember member = { 0 };
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    member.fd = fd;
+    member.dev = st.st_dev;
+    member.device = S_ISBLK(st.st_mode) || S_ISCHR(st.st_mode);
+
+    pthread_mutex_lock(&group->lock);
+    member.next = group->pending;
+    group->pending = &member;
+
+    while (!member.done) {
+        if (group->leader) {
+            pthread_cond_wait(&group->committed, &group->lock);
+            continue;
+        }
+
+        // Lead: take everything pending, including this member
+        ShredCommitMember* batch = group->pending;
+        group->pending = NULL;
+        group->leader = 1;
+        pthread_mutex_unlock(&group->lock);
+
+        commit_batch(batch);
+
+        pthread_mutex_lock(&group->lock);
+        for (ShredCommitMember* done = batch; done; ) {
+            // The owner may return as soon as done is set
+            ShredCommitMember* next = done->next;
+            done->done = 1;
+            done = next;
+        }
+        group->leader = 0;
+        pthread_cond_broadcast(&group->committed);
+    }
+    pthread_mutex_unlock(&group->lock);
+
+    if (member.error) {
+        errno = member.error;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef SHRED_COMMIT_H
+#define SHRED_COMMIT_H
+
+#include <pthread.h>
+
+typedef struct ShredCommitMember ShredCommitMember;
+
+// Group commit for pass barriers. Files shredded at the same time hand
+// their descriptors to one group; whoever arrives while no sync is
+// running becomes the leader and makes the whole pending batch durable at
+// once, while the barriers that come in meanwhile queue up for the next
+// batch. A sync per batch instead of one per file keeps barriers cheap
+// when many small files are in flight.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t committed;
+    ShredCommitMember* pending;
+    int leader;  // a batch is being synced
+} ShredCommitGroup;
+
+void shred_commit_init(ShredCommitGroup* group);
+void shred_commit_destroy(ShredCommitGroup* group);
+
+// Returns once everything written to fd so far is on stable storage.
+// Returns 0 on success, -1 with errno set when the sync covering fd failed.
+int shred_commit_sync(ShredCommitGroup* group, int fd);
+
+#endif /* SHRED_COMMIT_H */
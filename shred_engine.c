@@ -0,0 +1,931 @@
+#include "shred_engine.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+
+#define BYTE_PASS(b) { SHRED_PASS_BYTE, { (b) }, 1 }
+#define PATTERN_PASS(a, b, c) { SHRED_PASS_PATTERN, { (a), (b), (c) }, 3 }
+#define STREAM_PASS { SHRED_PASS_STREAM, { 0 }, 0 }
+
+static const ShredPass null_bytes_passes[] = {
+    BYTE_PASS(0x00)
+};
+
+static const ShredPass random_data_passes[] = {
+    STREAM_PASS
+};
+
+// DoD 5220.22-M: zeros, ones, then random
+static const ShredPass dod_passes[] = {
+    BYTE_PASS(0x00),
+    BYTE_PASS(0xFF),
+    STREAM_PASS
+};
+
+// Gutmann 35-pass overwrite: four random passes, the 27 MFM/RLL patterns,
+// four more random passes. One whole-file pass per entry.
+static const ShredPass gutmann_passes[] = {
+    STREAM_PASS, STREAM_PASS, STREAM_PASS, STREAM_PASS,
+    BYTE_PASS(0x55), BYTE_PASS(0xAA),
+    PATTERN_PASS(0x92, 0x49, 0x24), PATTERN_PASS(0x49, 0x24, 0x92), PATTERN_PASS(0x24, 0x92, 0x49),
+    BYTE_PASS(0x00), BYTE_PASS(0x11), BYTE_PASS(0x22), BYTE_PASS(0x33),
+    BYTE_PASS(0x44), BYTE_PASS(0x55), BYTE_PASS(0x66), BYTE_PASS(0x77),
+    BYTE_PASS(0x88), BYTE_PASS(0x99), BYTE_PASS(0xAA), BYTE_PASS(0xBB),
+    BYTE_PASS(0xCC), BYTE_PASS(0xDD), BYTE_PASS(0xEE), BYTE_PASS(0xFF),
+    PATTERN_PASS(0x92, 0x49, 0x24), PATTERN_PASS(0x49, 0x24, 0x92), PATTERN_PASS(0x24, 0x92, 0x49),
+    PATTERN_PASS(0x6D, 0xB6, 0xDB), PATTERN_PASS(0xB6, 0xDB, 0x6D), PATTERN_PASS(0xDB, 0x6D, 0xB6),
+    STREAM_PASS, STREAM_PASS, STREAM_PASS, STREAM_PASS
+};
+
+// 12-pass algorithm with a strong cryptographic stream cipher and dynamic IVs
+static const ShredPass polymorphic_passes[] = {
+    STREAM_PASS, STREAM_PASS, STREAM_PASS, STREAM_PASS,
+    STREAM_PASS, STREAM_PASS, STREAM_PASS, STREAM_PASS,
+    STREAM_PASS, STREAM_PASS, STREAM_PASS, STREAM_PASS
+};
+
+typedef struct {
+    const char* name;
+    const ShredPass* passes;
+    size_t count;
+} AlgorithmEntry;
+
+// Indexed by ShredAlgorithm
+static const AlgorithmEntry algorithms[] = {
+    { "nullbytes",   null_bytes_passes,  sizeof(null_bytes_passes) / sizeof(ShredPass) },
+    { "randomdata",  random_data_passes, sizeof(random_data_passes) / sizeof(ShredPass) },
+    { "dod5220",     dod_passes,         sizeof(dod_passes) / sizeof(ShredPass) },
+    { "gutmann",     gutmann_passes,     sizeof(gutmann_passes) / sizeof(ShredPass) },
+    { "polymorphic", polymorphic_passes, sizeof(polymorphic_passes) / sizeof(ShredPass) }
+};
+
+#define ALGORITHM_COUNT (sizeof(algorithms) / sizeof(algorithms[0]))
+
+const ShredPass* shred_algorithm_passes(ShredAlgorithm algorithm, size_t* count) {
+    if ((size_t)algorithm >= ALGORITHM_COUNT) {
+        *count = 0;
+        return NULL;
+    }
+
+    *count = algorithms[algorithm].count;
+    return algorithms[algorithm].passes;
+}
+
+const char* shred_algorithm_name(ShredAlgorithm algorithm) {
+    if ((size_t)algorithm >= ALGORITHM_COUNT) {
+        return "unknown";
+    }
+
+    return algorithms[algorithm].name;
+}
+
+int shred_algorithm_from_name(const char* name, ShredAlgorithm* algorithm) {
+    for (size_t i = 0; i < ALGORITHM_COUNT; i++) {
+        if (strcmp(name, algorithms[i].name) == 0) {
+            *algorithm = (ShredAlgorithm)i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static const char* discard_mode_names[] = { "none", "after", "only" };
+
+const char* shred_discard_mode_name(ShredDiscardMode mode) {
+    if ((size_t)mode >= sizeof(discard_mode_names) / sizeof(discard_mode_names[0])) {
+        return "unknown";
+    }
+
+    return discard_mode_names[mode];
+}
+
+int shred_discard_mode_from_name(const char* name, ShredDiscardMode* mode) {
+    for (size_t i = 0; i < sizeof(discard_mode_names) / sizeof(discard_mode_names[0]); i++) {
+        if (strcmp(name, discard_mode_names[i]) == 0) {
+            *mode = (ShredDiscardMode)i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void shred_options_init(ShredOptions* options) {
+    memset(options, 0, sizeof(*options));
+    options->backend = SHRED_BACKEND_PWRITE;
+    options->threads = 1;
+    options->queue_depth = SHRED_QUEUE_DEPTH;
+    options->sample_rate = SHRED_VERIFY_SAMPLE_RATE;
+    options->zero_offload = 1;
+}
+
+double shred_result_mbps(const ShredResult* result) {
+    if (result->seconds <= 0.0) {
+        return 0.0;
+    }
+
+    return (double)result->bytes_written / result->seconds / 1e6;
+}
+
+// State shared by every worker of one shred job
+typedef struct {
+    const ShredPass* passes;
+    size_t pass_count;
+    const ShredOptions* options;
+    unsigned char key[SHRED_KEY_SIZE];
+    unsigned char (*nonces)[SHRED_NONCE_SIZE];  // one per pass
+    ShredExtent* extents;                       // what the passes cover
+    size_t extent_count;
+    off_t file_size;
+    int device;                                 // fd is a whole disk
+    size_t block_size;
+    size_t tile_size;  // write size of fixed-pattern passes
+    off_t window;      // bytes every pass covers before the next window, 0 to sweep whole ranges
+    ShredThrottle throttle;  // the job limits of options->throttle, which it leads to
+} ShredJob;
+
+// One worker owns a disjoint set of byte ranges and its own descriptor
+typedef struct {
+    ShredJob* job;
+    int fd;
+    const ShredExtent* ranges;  // in file order
+    size_t range_count;
+    const ShredExtent* todo;    // what the current pass still has to cover
+    size_t todo_count;
+    ShredWriter writer;
+    ShredKeystream keystream;
+    ShredVerifyReport verify;
+    uint64_t bytes_written;
+    uint64_t bytes_discarded;
+    int discard_error;          // why the discard stopped, 0 when it did not
+    int status;
+    int error;
+    // Readings when the current stats stage began
+    uint64_t stage_wall;
+    uint64_t stage_cpu;
+    uint64_t stage_syscalls;
+    uint64_t stage_short_writes;
+    // With a journal: when the next checkpoint is due, and the position in
+    // todo up to which the journal already has the pass
+    double checkpoint_at;
+    size_t mark_range;
+    off_t mark_offset;
+} ShredWorker;
+
+// Accounts for a finished buffer. This is also where cancellation is
+// noticed: -1 with errno ECANCELED once options->cancel has been set.
+static int report_progress(ShredWorker* worker, size_t chunk) {
+    const ShredOptions* options = worker->job->options;
+
+    worker->bytes_written += chunk;
+    if (worker->writer.stage) {
+        shred_stats_add(&worker->writer.stage->bytes_written, chunk);
+    }
+    if (options->progress) {
+        shred_progress_add(options->progress, chunk);
+    }
+
+    if (options->cancel && atomic_load_explicit(options->cancel, memory_order_relaxed)) {
+        errno = ECANCELED;
+        return -1;
+    }
+    return 0;
+}
+
+// Charges what the worker does from now on to stage (NULL without stats)
+static void stage_begin(ShredWorker* worker, ShredStatsStage* stage) {
+    if (!stage) {
+        return;
+    }
+
+    worker->writer.stage = stage;
+    worker->stage_wall = shred_stats_clock();
+    worker->stage_cpu = shred_stats_cpu_clock();
+    worker->stage_syscalls = shred_io_thread_syscalls();
+    worker->stage_short_writes = shred_io_thread_short_writes();
+}
+
+static void stage_end(ShredWorker* worker) {
+    ShredStatsStage* stage = worker->writer.stage;
+    if (!stage) {
+        return;
+    }
+
+    shred_stats_add(&stage->wall_ns, shred_stats_clock() - worker->stage_wall);
+    shred_stats_add(&stage->cpu_ns, shred_stats_cpu_clock() - worker->stage_cpu);
+    shred_stats_add(&stage->syscalls, shred_io_thread_syscalls() - worker->stage_syscalls);
+    shred_stats_add(&stage->short_writes, shred_io_thread_short_writes() - worker->stage_short_writes);
+    worker->writer.stage = NULL;
+}
+
+// Start and end of pattern or keystream generation, for the stats
+static uint64_t generate_begin(const ShredWorker* worker) {
+    return worker->writer.stage ? shred_stats_clock() : 0;
+}
+
+static void generate_end(const ShredWorker* worker, uint64_t started) {
+    if (worker->writer.stage) {
+        shred_stats_add(&worker->writer.stage->generate_ns, shred_stats_clock() - started);
+    }
+}
+
+// Works out what pass still has to cover of the worker's ranges inside
+// [start, end), leaving out whatever the journal already has. *remaining
+// is what has to be freed.
+static int plan_pass(ShredWorker* worker, size_t pass, off_t start, off_t end, ShredExtent** remaining) {
+    ShredJournal* journal = worker->job->options->journal;
+    size_t done_count = 0;
+    const ShredExtent* done = journal ? shred_journal_done(journal, pass, &done_count) : NULL;
+
+    *remaining = NULL;
+    worker->todo = worker->ranges;
+    worker->todo_count = worker->range_count;
+    off_t last = worker->range_count > 0 ? worker->ranges[worker->range_count - 1].end : 0;
+    if (worker->range_count > 0 && (start > worker->ranges[0].start || end < last)) {
+        const ShredExtent outside[2] = { { 0, start }, { end, end > last ? end : last } };
+        if (shred_extent_subtract(worker->ranges, worker->range_count, outside, 2,
+                                  remaining, &worker->todo_count) != 0) {
+            return -1;
+        }
+        worker->todo = *remaining;
+    }
+    if (done_count > 0) {
+        ShredExtent* window = *remaining;
+        if (shred_extent_subtract(worker->todo, worker->todo_count, done, done_count,
+                                  remaining, &worker->todo_count) != 0) {
+            free(window);
+            return -1;
+        }
+        free(window);
+        worker->todo = *remaining;
+    }
+
+    worker->mark_range = 0;
+    worker->mark_offset = worker->todo_count > 0 ? worker->todo[0].start : 0;
+    worker->checkpoint_at = shred_io_now() + SHRED_JOURNAL_INTERVAL;
+    return 0;
+}
+
+static int checkpoint_due(const ShredWorker* worker) {
+    return worker->job->options->journal && shred_io_now() >= worker->checkpoint_at;
+}
+
+// Makes everything the pass wrote up to offset in todo[range] durable and
+// adds it to the journal; range todo_count stands for the end of the pass
+static int checkpoint(ShredWorker* worker, size_t pass, size_t range, off_t offset) {
+    if (shred_writer_sync(&worker->writer) != 0) {
+        return -1;
+    }
+
+    size_t last = range < worker->todo_count ? range : worker->todo_count;
+    ShredExtent* done = malloc((last - worker->mark_range + 1) * sizeof(ShredExtent));
+    if (!done) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t count = 0;
+    for (size_t r = worker->mark_range; r < worker->todo_count && r <= range; r++) {
+        off_t start = r == worker->mark_range ? worker->mark_offset : worker->todo[r].start;
+        off_t end = r == range ? offset : worker->todo[r].end;
+        if (end > start) {
+            done[count].start = start;
+            done[count].end = end;
+            count++;
+        }
+    }
+
+    int status = shred_journal_record(worker->job->options->journal, pass, done, count);
+    free(done);
+    worker->mark_range = range;
+    worker->mark_offset = offset;
+    worker->checkpoint_at = shred_io_now() + SHRED_JOURNAL_INTERVAL;
+    return status;
+}
+
+static size_t next_chunk(size_t limit, const ShredExtent* range, off_t offset) {
+    if ((off_t)limit > range->end - offset) {
+        return (size_t)(range->end - offset);
+    }
+    return limit;
+}
+
+static size_t pass_period(const ShredPass* pass) {
+    return pass->type == SHRED_PASS_BYTE ? 1 : pass->pattern_length;
+}
+
+// Lets the device zero the worker's ranges itself instead of pushing every
+// byte over the bus. Sets zeroed to the ranges it got through; the caller
+// writes the rest. Returns -1 only when cancelled.
+static int offload_zero_pass(ShredWorker* worker, const ShredPass* pass, size_t* zeroed) {
+    ShredJob* job = worker->job;
+
+    *zeroed = 0;
+    // The device zeroes at full speed, past any throttle
+    if (!job->device || !job->options->zero_offload || job->options->throttle ||
+        pass->type != SHRED_PASS_BYTE || pass->pattern[0] != 0x00) {
+        return 0;
+    }
+
+    for (size_t r = 0; r < worker->todo_count; r++) {
+        const ShredExtent* range = &worker->todo[r];
+
+        // Only whole ranges are ever zeroed, so writing picks up at this one
+        if (shred_io_zero_range(worker->fd, range->start, range->end - range->start) != 0) {
+            return 0;
+        }
+        *zeroed = r + 1;
+        if (report_progress(worker, (size_t)(range->end - range->start)) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int run_fixed_pass(ShredWorker* worker, const ShredPass* pass, size_t pass_index) {
+    size_t zeroed;
+    if (offload_zero_pass(worker, pass, &zeroed) != 0) {
+        return -1;
+    }
+
+    // Tile-sized writes keep the pattern phase, so one shared tile per
+    // phase a range starts at serves every write of the pass
+    const unsigned char* tiles[SHRED_PATTERN_PERIOD] = { NULL };
+    size_t tile_size = worker->job->tile_size;
+    int status = 0;
+
+    for (size_t r = zeroed; r < worker->todo_count && status == 0; r++) {
+        const ShredExtent* range = &worker->todo[r];
+        size_t phase = (size_t)range->start % SHRED_PATTERN_PERIOD;
+
+        if (!tiles[phase]) {
+            uint64_t started = generate_begin(worker);
+            tiles[phase] = shred_pattern_tile_acquire(pass->pattern, pass_period(pass), phase, tile_size);
+            generate_end(worker, started);
+            if (!tiles[phase]) {
+                status = -1;
+                break;
+            }
+        }
+
+        for (off_t offset = range->start; offset < range->end && status == 0; ) {
+            size_t chunk = next_chunk(tile_size, range, offset);
+
+            status = shred_writer_write(&worker->writer, tiles[phase], chunk, offset);
+            if (status == 0) {
+                offset += (off_t)chunk;
+                status = report_progress(worker, chunk);
+            }
+            if (status == 0 && checkpoint_due(worker)) {
+                status = checkpoint(worker, pass_index, r, offset);
+            }
+        }
+    }
+
+    // Queued writes may still read from the tiles
+    if (shred_writer_drain(&worker->writer) != 0) {
+        status = -1;
+    }
+    for (size_t i = 0; i < SHRED_PATTERN_PERIOD; i++) {
+        shred_pattern_tile_release(tiles[i]);
+    }
+    return status;
+}
+
+static int run_stream_pass(ShredWorker* worker, size_t pass_index) {
+    ShredJob* job = worker->job;
+
+    // Streaming stores read the keystream back right after it was made, so
+    // the mmap backend generates pieces that are still in cache by then
+    size_t limit = worker->writer.backend == SHRED_BACKEND_MMAP ? SHRED_MAP_STAGE_SIZE : job->block_size;
+
+    for (size_t r = 0; r < worker->todo_count; r++) {
+        const ShredExtent* range = &worker->todo[r];
+
+        // The pass keystream is seekable, so every range continues it at
+        // its own offset
+        if (shred_keystream_start(&worker->keystream, job->key, job->nonces[pass_index],
+                                  (uint64_t)range->start) != 0) {
+            return -1;
+        }
+
+        for (off_t offset = range->start; offset < range->end; ) {
+            size_t chunk = next_chunk(limit, range, offset);
+            unsigned char* buffer = shred_writer_buffer(&worker->writer);
+            if (!buffer) {
+                return -1;
+            }
+
+            // Pure keystream; the old contents are never read back
+            uint64_t started = generate_begin(worker);
+            int status = shred_keystream_generate(&worker->keystream, buffer, chunk);
+            generate_end(worker, started);
+            if (status != 0 || shred_writer_write(&worker->writer, buffer, chunk, offset) != 0) {
+                return -1;
+            }
+
+            offset += (off_t)chunk;
+            if (report_progress(worker, chunk) != 0) {
+                return -1;
+            }
+            if (checkpoint_due(worker) && checkpoint(worker, pass_index, r, offset) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Regenerates what the final pass wrote, for the verification stage
+static int fill_expected(void* context, unsigned char* buffer, off_t offset, size_t length) {
+    ShredWorker* worker = context;
+    ShredJob* job = worker->job;
+    size_t last = job->pass_count - 1;
+    const ShredPass* pass = &job->passes[last];
+
+    uint64_t started = generate_begin(worker);
+    int status = 0;
+    if (pass->type == SHRED_PASS_STREAM) {
+        status = shred_keystream_start(&worker->keystream, job->key, job->nonces[last], (uint64_t)offset);
+        if (status == 0) {
+            status = shred_keystream_generate(&worker->keystream, buffer, length);
+        }
+    } else {
+        size_t period = pass_period(pass);
+        shred_pattern_fill(buffer, length, pass->pattern, period, (size_t)offset % period);
+    }
+    generate_end(worker, started);
+    return status;
+}
+
+// Releases the worker's ranges to the device. Only a discard-only job
+// treats a device or file system without support as a failure; after a
+// full overwrite the blocks are already clean.
+static int discard_ranges(ShredWorker* worker) {
+    ShredDiscardMode mode = worker->job->options->discard;
+
+    for (size_t r = 0; r < worker->range_count; r++) {
+        const ShredExtent* range = &worker->ranges[r];
+
+        if (shred_io_discard(worker->fd, range->start, range->end - range->start) != 0) {
+            worker->discard_error = errno;
+            return mode == SHRED_DISCARD_ONLY ? -1 : 0;
+        }
+        worker->bytes_discarded += (uint64_t)(range->end - range->start);
+    }
+
+    return 0;
+}
+
+// Runs passes [0, pass_count) in order over the part of the worker's
+// ranges inside [start, end)
+static int run_passes(ShredWorker* worker, size_t pass_count, off_t start, off_t end) {
+    ShredJob* job = worker->job;
+    ShredStats* stats = job->options->stats;
+    int status = 0;
+
+    for (size_t i = 0; i < pass_count && status == 0; i++) {
+        ShredExtent* remaining;
+        stage_begin(worker, stats ? shred_stats_pass(stats, i, job->pass_count) : NULL);
+        status = plan_pass(worker, i, start, end, &remaining);
+        if (status == 0 && job->passes[i].type == SHRED_PASS_STREAM) {
+            status = run_stream_pass(worker, i);
+        } else if (status == 0) {
+            status = run_fixed_pass(worker, &job->passes[i], i);
+        }
+
+        // Without a barrier the page cache can fold consecutive passes into
+        // a single write-back, and only the last one ever reaches the disk.
+        // A journal only records what is durable, so it implies one. Within
+        // a window the passes follow each other so closely that they always
+        // need one, unless O_DIRECT already sent the writes to the device.
+        if (status == 0 && job->options->journal) {
+            status = checkpoint(worker, i, worker->todo_count, 0);
+        } else if (status == 0 && job->window > 0) {
+            status = worker->writer.direct ? shred_writer_drain(&worker->writer)
+                                           : shred_writer_sync(&worker->writer);
+        } else if (status == 0) {
+            status = job->options->pass_barrier ? shred_writer_sync(&worker->writer)
+                                                : shred_writer_flush(&worker->writer);
+        }
+        free(remaining);
+        stage_end(worker);
+    }
+
+    return status;
+}
+
+static void* worker_main(void* arg) {
+    ShredWorker* worker = arg;
+    ShredJob* job = worker->job;
+
+    worker->status = -1;
+    if (shred_keystream_init(&worker->keystream, job->options->cipher) != 0) {
+        worker->error = errno;
+        return NULL;
+    }
+
+    if (shred_writer_open(&worker->writer, worker->fd, job->options->backend, job->block_size,
+                          job->options->queue_depth) != 0) {
+        worker->error = errno;
+        shred_keystream_free(&worker->keystream);
+        return NULL;
+    }
+    ShredStats* stats = job->options->stats;
+    worker->writer.stats = stats;
+    worker->writer.commit = job->options->commit;
+    worker->writer.throttle = job->options->throttle ? &job->throttle : NULL;
+
+    // Passes run strictly in order over this worker's ranges, either one
+    // sweep of all of them per pass or every pass over one window before
+    // the next, which keeps the head of a disk in one place
+    int status = 0;
+    size_t pass_count = job->options->discard == SHRED_DISCARD_ONLY ? 0 : job->pass_count;
+    if (job->window > 0 && worker->range_count > 0) {
+        off_t end = worker->ranges[worker->range_count - 1].end;
+        for (off_t window = worker->ranges[0].start / job->window * job->window;
+             window < end && status == 0; window += job->window) {
+            status = run_passes(worker, pass_count, window, window + job->window);
+        }
+    } else {
+        status = run_passes(worker, pass_count, 0, job->file_size);
+    }
+
+    // Read back what the final pass left behind
+    if (pass_count > 0 && job->options->verify != SHRED_VERIFY_NONE && status == 0) {
+        stage_begin(worker, stats ? &stats->verify : NULL);
+    }
+    for (size_t r = 0; r < worker->range_count && pass_count > 0 && status == 0; r++) {
+        status = shred_verify_range(&worker->writer, worker->ranges[r].start, worker->ranges[r].end,
+                                    job->block_size, job->options->verify, job->options->sample_rate,
+                                    fill_expected, worker, &worker->verify);
+    }
+    stage_end(worker);
+
+    // Verified data must still be there to read, so release it last
+    if (status == 0 && job->options->discard != SHRED_DISCARD_NONE) {
+        stage_begin(worker, stats ? &stats->discard : NULL);
+        status = discard_ranges(worker);
+        stage_end(worker);
+    }
+
+    worker->error = errno;
+    shred_writer_close(&worker->writer);
+    shred_keystream_free(&worker->keystream);
+    worker->status = status;
+    return NULL;
+}
+
+static int job_init(ShredJob* job, int fd, off_t file_size, ShredAlgorithm algorithm,
+                    const ShredOptions* options) {
+    memset(job, 0, sizeof(*job));
+    job->options = options;
+    job->passes = shred_algorithm_passes(algorithm, &job->pass_count);
+    if (!job->passes) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    job->nonces = calloc(job->pass_count, sizeof(*job->nonces));
+    if (!job->nonces) {
+        return -1;
+    }
+
+    // One key per job, a new nonce for each pass
+    if (RAND_bytes(job->key, sizeof(job->key)) != 1 ||
+        RAND_bytes((unsigned char*)job->nonces, (int)(job->pass_count * sizeof(*job->nonces))) != 1) {
+        free(job->nonces);
+        errno = EIO;
+        return -1;
+    }
+
+    // A resumed job continues the keystreams the journal recorded
+    if (options->journal && options->discard != SHRED_DISCARD_ONLY &&
+        shred_journal_begin(options->journal, fd, file_size, (unsigned int)algorithm, job->pass_count,
+                            job->key, job->nonces) != 0) {
+        int saved_errno = errno;
+        OPENSSL_cleanse(job->key, sizeof(job->key));
+        free(job->nonces);
+        errno = saved_errno;
+        return -1;
+    }
+
+    job->file_size = file_size;
+    job->device = shred_io_is_device(fd);
+    job->block_size = shred_io_block_size(fd, options->block_size);
+    job->tile_size = shred_pattern_tile_size(job->block_size, shred_io_block_size(fd, 1));
+    if (options->pass_window > 0) {
+        off_t block = (off_t)job->block_size;
+        job->window = ((off_t)options->pass_window + block - 1) / block * block;
+    }
+
+    // Holes hold no data, so sparse files only need their allocated extents
+    int mapped = 0;
+    if (options->skip_holes) {
+        mapped = shred_extent_map(fd, file_size, shred_io_block_size(fd, 1),
+                                  &job->extents, &job->extent_count);
+    } else if (file_size > 0) {
+        job->extents = malloc(sizeof(ShredExtent));
+        if (job->extents) {
+            job->extents[0].start = 0;
+            job->extents[0].end = file_size;
+            job->extent_count = 1;
+        } else {
+            mapped = -1;
+        }
+    }
+    if (mapped != 0) {
+        int saved_errno = errno;
+        OPENSSL_cleanse(job->key, sizeof(job->key));
+        free(job->nonces);
+        errno = saved_errno;
+        return -1;
+    }
+
+    if (options->throttle) {
+        shred_throttle_init_job(&job->throttle, options->throttle);
+    }
+
+    if (options->progress) {
+        size_t passes = options->discard == SHRED_DISCARD_ONLY ? 0 : job->pass_count;
+        // Windows run every pass before moving on, so no pass covers the
+        // file and there is none to show
+        shred_progress_add_job(options->progress,
+                               (uint64_t)shred_extent_bytes(job->extents, job->extent_count) * passes,
+                               job->window > 0 ? 0 : (unsigned int)job->pass_count);
+        if (options->journal && passes > 0) {
+            shred_progress_add(options->progress, shred_journal_done_bytes(options->journal));
+        }
+    }
+    return 0;
+}
+
+// Counts a finished job in the stats
+static void job_finish(ShredJob* job, int status) {
+    ShredStats* stats = job->options->stats;
+    if (stats) {
+        shred_stats_add(&stats->files, 1);
+        shred_stats_add(&stats->failures, status != 0);
+    }
+}
+
+static void job_destroy(ShredJob* job) {
+    OPENSSL_cleanse(job->key, sizeof(job->key));
+    OPENSSL_cleanse(job->nonces, job->pass_count * sizeof(*job->nonces));
+    free(job->nonces);
+    free(job->extents);
+    if (job->options->throttle) {
+        shred_throttle_destroy(&job->throttle);
+    }
+}
+
+int shred_fd(int fd, off_t file_size, ShredAlgorithm algorithm,
+             const ShredOptions* options, ShredResult* result) {
+    ShredOptions defaults;
+    if (!options) {
+        shred_options_init(&defaults);
+        options = &defaults;
+    }
+    // Early failures leave nothing in it for the caller to misread
+    if (result) {
+        memset(result, 0, sizeof(*result));
+    }
+
+    ShredJob job;
+    if (job_init(&job, fd, file_size, algorithm, options) != 0) {
+        return -1;
+    }
+
+    ShredWorker worker;
+    memset(&worker, 0, sizeof(worker));
+    worker.job = &job;
+    worker.fd = fd;
+    worker.ranges = job.extents;
+    worker.range_count = job.extent_count;
+    shred_verify_report_init(&worker.verify, options->verify);
+
+    double start = shred_io_now();
+    worker_main(&worker);
+
+    if (result) {
+        result->bytes_written = worker.bytes_written;
+        result->bytes_discarded = worker.bytes_discarded;
+        result->discard_error = worker.discard_error;
+        result->bytes_skipped = (uint64_t)(file_size - shred_extent_bytes(job.extents, job.extent_count));
+        result->seconds = shred_io_now() - start;
+        result->verify = worker.verify;
+    }
+
+    job_finish(&job, worker.status);
+    job_destroy(&job);
+    errno = worker.error;
+    return worker.status;
+}
+
+// Deals the job extents out to the workers in file order, cutting them at
+// block boundaries so every worker gets about the same amount of data.
+// ranges needs room for extent_count + worker_count entries. Returns how
+// many workers got anything to do (at least one).
+static size_t split_extents(ShredJob* job, ShredWorker* workers, size_t worker_count, ShredExtent* ranges) {
+    off_t block_size = (off_t)job->block_size;
+    off_t data = shred_extent_bytes(job->extents, job->extent_count);
+    off_t share = (data / (off_t)worker_count + block_size - 1) / block_size * block_size;
+    size_t used = 0;
+    size_t w = 0;
+    off_t taken = 0;
+
+    workers[0].ranges = ranges;
+    for (size_t e = 0; e < job->extent_count; e++) {
+        for (off_t position = job->extents[e].start; position < job->extents[e].end; ) {
+            off_t end = job->extents[e].end;
+
+            // The last worker takes whatever is left
+            if (w + 1 < worker_count && taken + (end - position) > share) {
+                end = (position + share - taken + block_size - 1) / block_size * block_size;
+                if (end > job->extents[e].end) {
+                    end = job->extents[e].end;
+                }
+            }
+
+            ranges[used].start = position;
+            ranges[used].end = end;
+            used++;
+            workers[w].range_count++;
+            taken += end - position;
+            position = end;
+
+            if (w + 1 < worker_count && taken >= share) {
+                w++;
+                workers[w].ranges = &ranges[used];
+                taken = 0;
+            }
+        }
+    }
+
+    return workers[w].range_count > 0 || w == 0 ? w + 1 : w;
+}
+
+// Opens path relative to dirfd; extra flags (O_NOFOLLOW) apply to every
+// descriptor the workers open
+static int shred_at(int dirfd, const char* path, int flags, ShredAlgorithm algorithm,
+                    const ShredOptions* options, ShredResult* result) {
+    ShredOptions defaults;
+    if (!options) {
+        shred_options_init(&defaults);
+        options = &defaults;
+    }
+    if (result) {
+        memset(result, 0, sizeof(*result));
+    }
+
+    int fd = openat(dirfd, path, O_RDWR | O_CLOEXEC | flags);
+    if (fd < 0) {
+        return -1;
+    }
+
+#ifdef __linux__
+    // An exclusive open of a disk fails while it is mounted or claimed.
+    // It is only a check: holding the claim would make the kernel refuse
+    // BLKZEROOUT and BLKDISCARD on the workers' own descriptors.
+    if (shred_io_is_device(fd)) {
+        int claim = openat(dirfd, path, O_RDWR | O_EXCL | O_CLOEXEC | flags);
+        if (claim < 0) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+        close(claim);
+    }
+#endif
+
+    off_t size = shred_io_size(fd);
+    if (size < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    ShredJob job;
+    if (job_init(&job, fd, size, algorithm, options) != 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    // Never more workers than blocks of data
+    off_t block_size = (off_t)job.block_size;
+    off_t data = shred_extent_bytes(job.extents, job.extent_count);
+    off_t blocks = (data + block_size - 1) / block_size;
+    off_t worker_count = options->threads > 1 ? (off_t)options->threads : 1;
+    if (worker_count > blocks) {
+        worker_count = blocks > 0 ? blocks : 1;
+    }
+
+    ShredWorker* workers = calloc((size_t)worker_count, sizeof(ShredWorker));
+    pthread_t* threads = calloc((size_t)worker_count, sizeof(pthread_t));
+    ShredExtent* ranges = calloc(job.extent_count + (size_t)worker_count, sizeof(ShredExtent));
+    if (!workers || !threads || !ranges) {
+        free(workers);
+        free(threads);
+        free(ranges);
+        job_destroy(&job);
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    worker_count = (off_t)split_extents(&job, workers, (size_t)worker_count, ranges);
+
+    double start = shred_io_now();
+    int status = 0;
+    int error = 0;
+    off_t started = 0;
+
+    for (off_t i = 0; i < worker_count; i++) {
+        ShredWorker* worker = &workers[i];
+        worker->job = &job;
+        shred_verify_report_init(&worker->verify, options->verify);
+
+        // Each extra worker gets its own open file description, so O_DIRECT
+        // toggling and stdio buffering never leak between ranges
+        worker->fd = i == 0 ? fd : openat(dirfd, path, O_RDWR | O_CLOEXEC | flags);
+        if (worker->fd < 0) {
+            status = -1;
+            error = errno;
+            break;
+        }
+
+        if (worker_count == 1) {
+            worker_main(worker);
+        } else if (pthread_create(&threads[i], NULL, worker_main, worker) != 0) {
+            if (i > 0) {
+                close(worker->fd);
+            }
+            status = -1;
+            error = EAGAIN;
+            break;
+        }
+        started++;
+    }
+
+    for (off_t i = 0; i < started; i++) {
+        if (worker_count > 1) {
+            pthread_join(threads[i], NULL);
+        }
+        if (i > 0) {
+            close(workers[i].fd);
+        }
+        if (workers[i].status != 0 && status == 0) {
+            status = -1;
+            error = workers[i].error;
+        }
+    }
+
+    if (result) {
+        result->bytes_written = 0;
+        result->bytes_discarded = 0;
+        result->discard_error = 0;
+        result->bytes_skipped = (uint64_t)(size - data);
+        shred_verify_report_init(&result->verify, options->verify);
+        for (off_t i = 0; i < started; i++) {
+            result->bytes_written += workers[i].bytes_written;
+            result->bytes_discarded += workers[i].bytes_discarded;
+            if (result->discard_error == 0) {
+                result->discard_error = workers[i].discard_error;
+            }
+            shred_verify_report_merge(&result->verify, &workers[i].verify);
+        }
+        result->seconds = shred_io_now() - start;
+    }
+
+    free(workers);
+    free(threads);
+    free(ranges);
+    job_finish(&job, status);
+    job_destroy(&job);
+    close(fd);
+    errno = error;
+    return status;
+}
+
+int shred_path(const char* path, ShredAlgorithm algorithm,
+               const ShredOptions* options, ShredResult* result) {
+    return shred_at(AT_FDCWD, path, 0, algorithm, options, result);
+}
+
+int shred_path_at(int dirfd, const char* name, ShredAlgorithm algorithm,
+                  const ShredOptions* options, ShredResult* result) {
+    return shred_at(dirfd, name, O_NOFOLLOW, algorithm, options, result);
+}
@@ -0,0 +1,115 @@
+#ifndef SHRED_ENGINE_H
+#define SHRED_ENGINE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "shred_io.h"
+#include "shred_extent.h"
+#include "shred_keystream.h"
+#include "shred_pattern.h"
+#include "shred_progress.h"
+#include "shred_verify.h"
+#include "shred_store.h"
+#include "shred_journal.h"
+
+// Longest repeating pattern a pass descriptor can carry
+#define SHRED_PATTERN_MAX SHRED_PATTERN_PERIOD
+
+// Fraction of units read back by sampled verification
+#define SHRED_VERIFY_SAMPLE_RATE 0.01
+
+typedef enum {
+    SHRED_ALGORITHM_NULL_BYTES,
+    SHRED_ALGORITHM_RANDOM_DATA,
+    SHRED_ALGORITHM_DOD,
+    SHRED_ALGORITHM_GUTMANN,
+    SHRED_ALGORITHM_POLYMORPHIC_12_PASS
+} ShredAlgorithm;
+
+typedef enum {
+    SHRED_PASS_BYTE,     // Every byte set to pattern[0]
+    SHRED_PASS_PATTERN,  // pattern[0..pattern_length) repeated from offset 0
+    SHRED_PASS_STREAM    // CSPRNG keystream with a fresh nonce for every pass
+} ShredPassType;
+
+typedef struct {
+    ShredPassType type;
+    unsigned char pattern[SHRED_PATTERN_MAX];
+    size_t pattern_length;
+} ShredPass;
+
+// Workers per file for each CPU; more only adds threads waiting on the disk
+#define SHRED_MAX_THREADS_PER_CPU 4
+
+typedef enum {
+    SHRED_DISCARD_NONE,   // leave the overwritten blocks allocated
+    SHRED_DISCARD_AFTER,  // release them once the passes are done, best effort
+    SHRED_DISCARD_ONLY    // no passes, only release the blocks (flash devices)
+} ShredDiscardMode;
+
+typedef struct {
+    ShredBackend backend;
+    size_t block_size;           // 0 uses SHRED_BUFFER_SIZE
+    unsigned int threads;        // workers per file in shred_path, each on its own range
+    unsigned int queue_depth;    // writes in flight per worker with the uring backend
+    ShredCipher cipher;          // keystream for stream passes, chosen per CPU by default
+    int skip_holes;              // only overwrite the allocated extents of sparse files
+    ShredDiscardMode discard;    // TRIM / hole punching after (or instead of) the passes
+    int zero_offload;            // let block devices run zero passes themselves (BLKZEROOUT)
+    int pass_barrier;            // make every pass durable before the next one starts
+    size_t pass_window;          // run all passes over windows of this many bytes in turn, 0 sweeps the file per pass
+    ShredCommitGroup* commit;    // shared by files shredded together to batch their barriers, may be NULL
+    ShredJournal* journal;       // checkpoints of a single job for a later run to resume from, may be NULL
+    ShredThrottle* throttle;     // bandwidth and IOPS limits over all jobs and per job, may be NULL
+    ShredVerifyMode verify;      // read back the final pass
+    double sample_rate;          // fraction of units checked in sample mode
+    ShredProgress* progress;     // counters for a reporter to sample, may be NULL
+    ShredStats* stats;           // per-pass timings and I/O latency histograms, may be NULL
+    const atomic_int* cancel;    // when set, workers stop at the next buffer (ECANCELED)
+} ShredOptions;
+
+typedef struct {
+    uint64_t bytes_written;
+    uint64_t bytes_skipped;      // holes left alone with skip_holes
+    uint64_t bytes_discarded;    // released to the device by the discard stage
+    int discard_error;           // errno of a discard that failed (EOPNOTSUPP without support), 0 otherwise
+    double seconds;
+    ShredVerifyReport verify;
+} ShredResult;
+
+const ShredPass* shred_algorithm_passes(ShredAlgorithm algorithm, size_t* count);
+const char* shred_algorithm_name(ShredAlgorithm algorithm);
+int shred_algorithm_from_name(const char* name, ShredAlgorithm* algorithm);
+
+const char* shred_discard_mode_name(ShredDiscardMode mode);
+int shred_discard_mode_from_name(const char* name, ShredDiscardMode* mode);
+
+void shred_options_init(ShredOptions* options);
+
+// Runs every pass of the algorithm over the first file_size bytes of fd
+// (only over the allocated extents with options->skip_holes).
+// Returns 0 on success, -1 on an I/O or crypto failure (errno is set).
+// result may be NULL; otherwise it is cleared first, so it is safe to read
+// after any failure.
+int shred_fd(int fd, off_t file_size, ShredAlgorithm algorithm,
+             const ShredOptions* options, ShredResult* result);
+
+// Opens path (a regular file or a whole block device, which must not be
+// mounted) and splits it (or its allocated extents with skip_holes) into
+// options->threads disjoint, block-aligned sets of ranges carrying the same
+// amount of data. Every worker opens its own descriptor and runs all passes
+// in order over its ranges with positional I/O.
+int shred_path(const char* path, ShredAlgorithm algorithm,
+               const ShredOptions* options, ShredResult* result);
+
+// shred_path for name inside the directory open as dirfd, so trees are
+// shredded without the kernel resolving full paths over and over. A
+// symbolic link at name is never followed (ELOOP).
+int shred_path_at(int dirfd, const char* name, ShredAlgorithm algorithm,
+                  const ShredOptions* options, ShredResult* result);
+
+double shred_result_mbps(const ShredResult* result);
+
+#endif /* SHRED_ENGINE_H */
@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+#include "shred_extent.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+static int append_extent(ShredExtent** extents, size_t* count, size_t* capacity, off_t start, off_t end) {
+    // Widening to alignment can make neighbours touch; merge them
+    if (*count > 0 && (*extents)[*count - 1].end >= start) {
+        if (end > (*extents)[*count - 1].end) {
+            (*extents)[*count - 1].end = end;
+        }
+        return 0;
+    }
+
+    if (*count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 16;
+        ShredExtent* larger = realloc(*extents, grown * sizeof(ShredExtent));
+        if (!larger) {
+            return -1;
+        }
+        *extents = larger;
+        *capacity = grown;
+    }
+
+    (*extents)[*count].start = start;
+    (*extents)[*count].end = end;
+    (*count)++;
+    return 0;
+}
+
+int shred_extent_map(int fd, off_t size, size_t alignment, ShredExtent** extents, size_t* count) {
+    size_t capacity = 0;
+    off_t align = alignment ? (off_t)alignment : 1;
+
+    *extents = NULL;
+    *count = 0;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    for (off_t position = 0; position < size; ) {
+        off_t data = lseek(fd, position, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) {
+                // Only a hole is left up to the end of the file
+                return 0;
+            }
+            // Not supported here; shred everything
+            *count = 0;
+            break;
+        }
+        if (data >= size) {
+            return 0;
+        }
+
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0 || hole > size) {
+            hole = size;
+        }
+
+        off_t start = data / align * align;
+        off_t end = (hole + align - 1) / align * align;
+        if (end > size) {
+            end = size;
+        }
+        if (append_extent(extents, count, &capacity, start, end) != 0) {
+            free(*extents);
+            *extents = NULL;
+            *count = 0;
+            errno = ENOMEM;
+            return -1;
+        }
+
+        position = hole;
+    }
+
+    if (*count > 0 || size == 0) {
+        return 0;
+    }
+#endif
+
+    if (size > 0 && append_extent(extents, count, &capacity, 0, size) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+off_t shred_extent_bytes(const ShredExtent* extents, size_t count) {
+    off_t total = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        total += extents[i].end - extents[i].start;
+    }
+    return total;
+}
+
+static int compare_extents(const void* a, const void* b) {
+    const ShredExtent* x = a;
+    const ShredExtent* y = b;
+
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+size_t shred_extent_normalize(ShredExtent* extents, size_t count) {
+    size_t merged = 0;
+
+    qsort(extents, count, sizeof(ShredExtent), compare_extents);
+    for (size_t i = 0; i < count; i++) {
+        if (merged > 0 && extents[merged - 1].end >= extents[i].start) {
+            if (extents[i].end > extents[merged - 1].end) {
+                extents[merged - 1].end = extents[i].end;
+            }
+        } else {
+            extents[merged++] = extents[i];
+        }
+    }
+    return merged;
+}
+
+int shred_extent_subtract(const ShredExtent* extents, size_t count, const ShredExtent* cut, size_t cut_count,
+                          ShredExtent** remaining, size_t* remaining_count) {
+    size_t capacity = 0;
+    size_t c = 0;
+    int status = 0;
+
+    *remaining = NULL;
+    *remaining_count = 0;
+    for (size_t i = 0; i < count && status == 0; i++) {
+        off_t position = extents[i].start;
+
+        // Cuts wholly before this extent never matter again
+        while (c < cut_count && cut[c].end <= position) {
+            c++;
+        }
+        for (size_t k = c; k < cut_count && cut[k].start < extents[i].end && status == 0; k++) {
+            if (cut[k].start > position) {
+                status = append_extent(remaining, remaining_count, &capacity, position, cut[k].start);
+            }
+            if (cut[k].end > position) {
+                position = cut[k].end;
+            }
+        }
+        if (position < extents[i].end && status == 0) {
+            status = append_extent(remaining, remaining_count, &capacity, position, extents[i].end);
+        }
+    }
+
+    if (status != 0) {
+        free(*remaining);
+        *remaining = NULL;
+        *remaining_count = 0;
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef SHRED_EXTENT_H
+#define SHRED_EXTENT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// A byte range [start, end) of a file
+typedef struct {
+    off_t start;
+    off_t end;
+} ShredExtent;
+
+// Lists the ranges of the first size bytes of fd that hold data, in file
+// order, widened to multiples of alignment. Holes in sparse files are left
+// out (SEEK_DATA/SEEK_HOLE); where the file system cannot tell, the whole
+// file is one extent. *extents is malloc'd and owned by the caller.
+int shred_extent_map(int fd, off_t size, size_t alignment, ShredExtent** extents, size_t* count);
+
+// Total bytes covered by the extents
+off_t shred_extent_bytes(const ShredExtent* extents, size_t count);
+
+// Sorts extents and merges the ones that overlap or touch; returns the new
+// count
+size_t shred_extent_normalize(ShredExtent* extents, size_t count);
+
+// The parts of extents (in file order) that none of cut (sorted and
+// disjoint) covers. *remaining is malloc'd and owned by the caller.
+int shred_extent_subtract(const ShredExtent* extents, size_t count, const ShredExtent* cut, size_t cut_count,
+                          ShredExtent** remaining, size_t* remaining_count);
+
+#endif /* SHRED_EXTENT_H */
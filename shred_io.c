@@ -0,0 +1,806 @@
+#define _GNU_SOURCE
+#include "shred_io.h"
+#include "shred_uring.h"
+#include "shred_store.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <linux/falloc.h>
+#endif
+
+#ifdef __APPLE__
+#include <sys/disk.h>
+#endif
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define POOL_SLOTS 16
+
+static const char* backend_names[] = { "stdio", "pwrite", "direct", "uring", "mmap" };
+
+static atomic_ullong syscall_count;
+static _Thread_local uint64_t thread_syscalls;
+static _Thread_local uint64_t thread_short_writes;
+
+// Released buffers waiting to be reused
+static ShredBuffer pool[POOL_SLOTS];
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+const char* shred_backend_name(ShredBackend backend) {
+    if ((size_t)backend >= sizeof(backend_names) / sizeof(backend_names[0])) {
+        return "unknown";
+    }
+
+    return backend_names[backend];
+}
+
+int shred_backend_from_name(const char* name, ShredBackend* backend) {
+    for (size_t i = 0; i < sizeof(backend_names) / sizeof(backend_names[0]); i++) {
+        if (strcmp(name, backend_names[i]) == 0) {
+            *backend = (ShredBackend)i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static void* map_buffer(size_t size) {
+    void* data;
+
+#ifdef MAP_HUGETLB
+    // Explicit huge pages only exist when the administrator reserved some
+    if (size % HUGE_PAGE_SIZE == 0) {
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED) {
+            return data;
+        }
+    }
+#endif
+
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+#ifdef MADV_HUGEPAGE
+    // Fall back to transparent huge pages
+    if (size % HUGE_PAGE_SIZE == 0) {
+        madvise(data, size, MADV_HUGEPAGE);
+    }
+#endif
+
+    return data;
+}
+
+int shred_buffer_acquire(ShredBuffer* buffer, size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t granule = size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : page;
+    size = (size + granule - 1) / granule * granule;
+
+    // Reuse the smallest pooled buffer that is large enough
+    pthread_mutex_lock(&pool_lock);
+    int best = -1;
+    for (int i = 0; i < POOL_SLOTS; i++) {
+        if (pool[i].data && pool[i].size >= size && (best < 0 || pool[i].size < pool[best].size)) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        *buffer = pool[best];
+        pool[best].data = NULL;
+        pool[best].size = 0;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (best >= 0) {
+        return 0;
+    }
+
+    buffer->data = map_buffer(size);
+    if (!buffer->data) {
+        buffer->size = 0;
+        return -1;
+    }
+
+    buffer->size = size;
+    return 0;
+}
+
+void shred_buffer_release(ShredBuffer* buffer) {
+    if (!buffer->data) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < POOL_SLOTS; i++) {
+        if (!pool[i].data) {
+            pool[i] = *buffer;
+            buffer->data = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    // Pool is full, give the memory back
+    if (buffer->data) {
+        munmap(buffer->data, buffer->size);
+    }
+
+    buffer->data = NULL;
+    buffer->size = 0;
+}
+
+static int is_device(const struct stat* st) {
+#ifdef __APPLE__
+    // Raw disks (/dev/rdiskN) are character devices on macOS
+    return S_ISBLK(st->st_mode) || S_ISCHR(st->st_mode);
+#else
+    return S_ISBLK(st->st_mode);
+#endif
+}
+
+// Physical sector size of a disk, 0 when fd is not one
+static size_t device_sector_size(int fd) {
+#if defined(BLKPBSZGET)
+    unsigned int sector = 0;
+    if (ioctl(fd, BLKPBSZGET, &sector) == 0) {
+        return sector;
+    }
+#elif defined(DKIOCGETPHYSICALBLOCKSIZE)
+    uint32_t sector = 0;
+    if (ioctl(fd, DKIOCGETPHYSICALBLOCKSIZE, &sector) == 0) {
+        return sector;
+    }
+#else
+    (void)fd;
+#endif
+    return 0;
+}
+
+size_t shred_io_block_size(int fd, size_t requested) {
+    struct stat st;
+    size_t block = 4096;
+
+    if (fstat(fd, &st) == 0) {
+        if (st.st_blksize > 0) {
+            block = (size_t)st.st_blksize;
+        }
+
+        // Never split a physical sector (4Kn and 512e drives alike)
+        size_t sector = is_device(&st) ? device_sector_size(fd) : 0;
+        if (sector > block) {
+            block = sector;
+        }
+    }
+
+    size_t size = requested ? requested : SHRED_BUFFER_SIZE;
+    if (size < block) {
+        return block;
+    }
+
+    return (size + block - 1) / block * block;
+}
+
+static int set_direct(int fd, int enable) {
+#if defined(O_DIRECT)
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0) {
+        return -1;
+    }
+
+    flags = enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+    return fcntl(fd, F_SETFL, flags);
+#elif defined(F_NOCACHE)
+    return fcntl(fd, F_NOCACHE, enable);
+#else
+    (void)fd;
+    if (enable) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+// A store into a hole that cannot be allocated, or past an end truncated
+// under the mapping, raises SIGBUS instead of failing a call, so only
+// regular files with every block already allocated are mapped
+static int map_usable(int fd, off_t* size) {
+    struct stat st;
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags < 0 || (flags & O_ACCMODE) != O_RDWR || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+
+    *size = st.st_size;
+    return (off_t)st.st_blocks * 512 >= st.st_size;
+}
+
+static int unmap_window(ShredWriter* writer) {
+    if (!writer->map) {
+        return 0;
+    }
+
+    // Hand the window to write-back; the data is already in the page cache
+    shred_io_count_syscalls(2);
+    int status = msync(writer->map, writer->map_length, MS_ASYNC);
+    if (munmap(writer->map, writer->map_length) != 0) {
+        status = -1;
+    }
+    writer->map = NULL;
+    writer->map_length = 0;
+    return status;
+}
+
+// Maps the window holding [offset, offset + length). When the file cannot
+// be mapped the writer falls back to pwrite and -1 is returned.
+static int map_window(ShredWriter* writer, off_t offset, size_t length) {
+    if (writer->map && offset >= writer->map_offset &&
+        offset + (off_t)length <= writer->map_offset + (off_t)writer->map_length) {
+        return 0;
+    }
+    if (unmap_window(writer) != 0) {
+        return -1;
+    }
+
+    off_t start = offset / SHRED_MAP_WINDOW * SHRED_MAP_WINDOW;
+    off_t end = start + SHRED_MAP_WINDOW;
+    if (end < offset + (off_t)length) {
+        end = offset + (off_t)length;
+    }
+    if (end > writer->map_limit) {
+        end = writer->map_limit;
+    }
+    if (end < offset + (off_t)length) {
+        // The file grew since the writer was opened
+        writer->backend = SHRED_BACKEND_PWRITE;
+        return -1;
+    }
+
+    shred_io_count_syscalls(1);
+    void* map = mmap(NULL, (size_t)(end - start), PROT_READ | PROT_WRITE, MAP_SHARED, writer->fd, start);
+    if (map == MAP_FAILED) {
+        writer->backend = SHRED_BACKEND_PWRITE;
+        return -1;
+    }
+
+#ifdef MADV_POPULATE_WRITE
+    // Fault the window in writable with one call instead of once per page
+    shred_io_count_syscalls(1);
+    madvise(map, (size_t)(end - start), MADV_POPULATE_WRITE);
+#endif
+
+    writer->map = map;
+    writer->map_offset = start;
+    writer->map_length = (size_t)(end - start);
+    return 0;
+}
+
+int shred_writer_open(ShredWriter* writer, int fd, ShredBackend backend, size_t block_size,
+                      unsigned int queue_depth) {
+    memset(writer, 0, sizeof(*writer));
+    writer->backend = backend;
+    writer->fd = fd;
+    writer->alignment = shred_io_block_size(fd, 1);
+    writer->buffer_count = 1;
+
+    if (backend == SHRED_BACKEND_URING) {
+        if (queue_depth == 0) {
+            queue_depth = SHRED_QUEUE_DEPTH;
+        }
+        writer->buffer_count = queue_depth < SHRED_MAX_QUEUE_DEPTH ? queue_depth : SHRED_MAX_QUEUE_DEPTH;
+    }
+
+    for (unsigned int i = 0; i < writer->buffer_count; i++) {
+        if (shred_buffer_acquire(&writer->buffers[i], block_size) != 0) {
+            shred_writer_close(writer);
+            return -1;
+        }
+    }
+
+    if (backend == SHRED_BACKEND_URING) {
+        writer->ring = shred_ring_open(fd, writer->buffer_count, writer->buffers, writer->buffer_count);
+        if (!writer->ring) {
+            writer->backend = SHRED_BACKEND_PWRITE;
+        } else if (set_direct(fd, 1) == 0) {
+            writer->direct = 1;
+            writer->use_direct = 1;
+        }
+    }
+
+    if (backend == SHRED_BACKEND_STDIO) {
+        // Own FILE* on a duplicate so fclose leaves the caller's fd open
+        int copy = dup(fd);
+        if (copy < 0) {
+            shred_writer_close(writer);
+            return -1;
+        }
+
+        writer->fp = fdopen(copy, "r+b");
+        if (!writer->fp) {
+            close(copy);
+            shred_writer_close(writer);
+            return -1;
+        }
+    } else if (backend == SHRED_BACKEND_DIRECT) {
+        if (set_direct(fd, 1) != 0) {
+            shred_writer_close(writer);
+            return -1;
+        }
+        writer->direct = 1;
+        writer->use_direct = 1;
+    } else if (backend == SHRED_BACKEND_MMAP && !map_usable(fd, &writer->map_limit)) {
+        writer->backend = SHRED_BACKEND_PWRITE;
+    }
+
+    return 0;
+}
+
+// Adds the time since started to one of the stage timers and counts a
+// failed call as an error
+static void account(ShredWriter* writer, _Atomic uint64_t* timer, uint64_t started, int status) {
+    shred_stats_add(timer, shred_stats_clock() - started);
+    if (status != 0) {
+        shred_stats_add(&writer->stage->errors, 1);
+    }
+}
+
+unsigned char* shred_writer_buffer(ShredWriter* writer) {
+    if (!writer->ring) {
+        return writer->buffers[0].data;
+    }
+
+    // Round robin, waiting for the oldest write from this buffer if needed
+    unsigned int index = writer->next_buffer;
+    writer->next_buffer = (index + 1) % writer->buffer_count;
+    uint64_t started = writer->stage ? shred_stats_clock() : 0;
+    int status = shred_ring_wait_buffer(writer->ring, (int)index);
+    if (writer->stage) {
+        account(writer, &writer->stage->write_ns, started, status);
+    }
+    if (status != 0) {
+        return NULL;
+    }
+
+    return writer->buffers[index].data;
+}
+
+static int buffer_index(ShredWriter* writer, const void* buffer) {
+    const unsigned char* data = buffer;
+
+    for (unsigned int i = 0; i < writer->buffer_count; i++) {
+        if (data >= writer->buffers[i].data && data < writer->buffers[i].data + writer->buffers[i].size) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static int drain_writes(ShredWriter* writer) {
+    if (writer->ring) {
+        return shred_ring_drain(writer->ring);
+    }
+
+    return 0;
+}
+
+static int flush_writes(ShredWriter* writer) {
+    if (writer->fp) {
+        return fflush(writer->fp);
+    }
+
+    return drain_writes(writer);
+}
+
+static int prepare_direct(ShredWriter* writer, const void* buffer, size_t length, off_t offset) {
+    if (!writer->use_direct) {
+        return 0;
+    }
+
+    // Unaligned requests (the file tail) go through the page cache, and
+    // the next aligned one turns O_DIRECT back on
+    int aligned = length % writer->alignment == 0 && (size_t)offset % writer->alignment == 0 &&
+                  (uintptr_t)buffer % writer->alignment == 0;
+    if (aligned == writer->direct) {
+        return 0;
+    }
+
+    // Queued writes must not see the flag change under them
+    if (drain_writes(writer) != 0 || set_direct(writer->fd, aligned) != 0) {
+        return -1;
+    }
+    writer->direct = aligned;
+    return 0;
+}
+
+static int write_data(ShredWriter* writer, const void* buffer, size_t length, off_t offset) {
+    if (writer->backend == SHRED_BACKEND_STDIO) {
+        shred_io_count_syscalls(1);
+        if (fseeko(writer->fp, offset, SEEK_SET) != 0 ||
+            fwrite(buffer, sizeof(char), length, writer->fp) != length) {
+            return -1;
+        }
+        return 0;
+    }
+
+    // Stored straight into the page cache, skipping the copy a write call
+    // makes; a window that cannot be mapped leaves the rest to pwrite
+    if (writer->backend == SHRED_BACKEND_MMAP && map_window(writer, offset, length) == 0) {
+        shred_store_stream(writer->map + (offset - writer->map_offset), buffer, length);
+        return 0;
+    }
+
+    if (prepare_direct(writer, buffer, length, offset) != 0) {
+        return -1;
+    }
+
+    if (writer->ring) {
+        return shred_ring_write(writer->ring, buffer_index(writer, buffer), buffer, length, offset);
+    }
+
+    const unsigned char* data = buffer;
+    while (length > 0) {
+        ssize_t written = pwrite(writer->fd, data, length, offset);
+        shred_io_count_syscalls(1);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (written == 0) {
+            errno = EIO;
+            return -1;
+        }
+        if ((size_t)written < length) {
+            shred_io_count_short_write();
+        }
+
+        data += written;
+        length -= (size_t)written;
+        offset += written;
+    }
+
+    return 0;
+}
+
+static int read_data(ShredWriter* writer, void* buffer, size_t length, off_t offset) {
+    if (writer->backend == SHRED_BACKEND_STDIO) {
+        shred_io_count_syscalls(1);
+        if (fseeko(writer->fp, offset, SEEK_SET) != 0 ||
+            fread(buffer, sizeof(char), length, writer->fp) != length) {
+            if (errno == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        return 0;
+    }
+
+    if (prepare_direct(writer, buffer, length, offset) != 0) {
+        return -1;
+    }
+
+    unsigned char* data = buffer;
+    while (length > 0) {
+        ssize_t got = pread(writer->fd, data, length, offset);
+        shred_io_count_syscalls(1);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (got == 0) {
+            errno = EIO;
+            return -1;
+        }
+
+        data += got;
+        length -= (size_t)got;
+        offset += got;
+    }
+
+    return 0;
+}
+
+// Writes while reporting the latency to the throttle, whose wait is kept
+// out of the stage timers
+static int observed_write(ShredWriter* writer, const void* buffer, size_t length, off_t offset) {
+    if (!writer->throttle) {
+        return write_data(writer, buffer, length, offset);
+    }
+
+    double started = shred_io_now();
+    int status = write_data(writer, buffer, length, offset);
+    if (status == 0) {
+        shred_throttle_observe(writer->throttle, length, shred_io_now() - started);
+    }
+    return status;
+}
+
+int shred_writer_write(ShredWriter* writer, const void* buffer, size_t length, off_t offset) {
+    if (writer->throttle) {
+        shred_throttle_acquire(writer->throttle, length);
+    }
+
+    if (!writer->stage) {
+        return observed_write(writer, buffer, length, offset);
+    }
+
+    uint64_t started = shred_stats_clock();
+    int status = observed_write(writer, buffer, length, offset);
+    account(writer, &writer->stage->write_ns, started, status);
+    if (writer->stats) {
+        shred_histogram_record(&writer->stats->write_latency, shred_stats_clock() - started);
+    }
+    return status;
+}
+
+int shred_writer_read(ShredWriter* writer, void* buffer, size_t length, off_t offset) {
+    if (writer->throttle) {
+        shred_throttle_acquire(writer->throttle, length);
+    }
+
+    if (!writer->stage) {
+        return read_data(writer, buffer, length, offset);
+    }
+
+    uint64_t started = shred_stats_clock();
+    int status = read_data(writer, buffer, length, offset);
+    account(writer, &writer->stage->read_ns, started, status);
+    if (status == 0) {
+        shred_stats_add(&writer->stage->bytes_read, length);
+    }
+    return status;
+}
+
+int shred_writer_drain(ShredWriter* writer) {
+    if (!writer->stage) {
+        return drain_writes(writer);
+    }
+
+    uint64_t started = shred_stats_clock();
+    int status = drain_writes(writer);
+    account(writer, &writer->stage->flush_ns, started, status);
+    return status;
+}
+
+int shred_writer_flush(ShredWriter* writer) {
+    if (!writer->stage) {
+        return flush_writes(writer);
+    }
+
+    uint64_t started = shred_stats_clock();
+    int status = flush_writes(writer);
+    account(writer, &writer->stage->flush_ns, started, status);
+    return status;
+}
+
+static int sync_writes(ShredWriter* writer) {
+    // Mapped pages cannot be dropped from the cache, which verification
+    // needs to do after a sync; the window is mapped again on the next write
+    if (unmap_window(writer) != 0) {
+        return -1;
+    }
+    return writer->commit ? shred_commit_sync(writer->commit, writer->fd) : shred_io_sync(writer->fd);
+}
+
+int shred_writer_sync(ShredWriter* writer) {
+    if (!writer->stage) {
+        return flush_writes(writer) == 0 ? sync_writes(writer) : -1;
+    }
+
+    uint64_t started = shred_stats_clock();
+    int status = flush_writes(writer);
+    if (status == 0) {
+        uint64_t synced = shred_stats_clock();
+        status = sync_writes(writer);
+        if (writer->stats) {
+            shred_histogram_record(&writer->stats->sync_latency, shred_stats_clock() - synced);
+        }
+    }
+    account(writer, &writer->stage->flush_ns, started, status);
+    return status;
+}
+
+void shred_writer_close(ShredWriter* writer) {
+    unmap_window(writer);
+
+    if (writer->ring) {
+        shred_ring_close(writer->ring);
+        writer->ring = NULL;
+    }
+
+    if (writer->fp) {
+        fclose(writer->fp);
+        writer->fp = NULL;
+    }
+
+    if (writer->direct) {
+        set_direct(writer->fd, 0);
+        writer->direct = 0;
+    }
+
+    for (unsigned int i = 0; i < writer->buffer_count; i++) {
+        shred_buffer_release(&writer->buffers[i]);
+    }
+}
+
+int shred_io_sync(int fd) {
+    shred_io_count_syscalls(1);
+#if defined(F_FULLFSYNC)
+    // fsync on macOS leaves the data in the drive's write cache
+    if (fcntl(fd, F_FULLFSYNC) == 0) {
+        return 0;
+    }
+    return fsync(fd);
+#elif defined(__linux__)
+    return fdatasync(fd);
+#else
+    return fsync(fd);
+#endif
+}
+
+void shred_io_drop_cache(int fd, off_t offset, off_t length) {
+#if defined(POSIX_FADV_DONTNEED)
+    shred_io_count_syscalls(1);
+    posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
+#else
+    (void)fd;
+    (void)offset;
+    (void)length;
+#endif
+}
+
+off_t shred_io_size(int fd) {
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    if (!is_device(&st)) {
+        return st.st_size;
+    }
+
+#if defined(BLKGETSIZE64)
+    uint64_t bytes;
+    if (ioctl(fd, BLKGETSIZE64, &bytes) != 0) {
+        return -1;
+    }
+    return (off_t)bytes;
+#elif defined(DKIOCGETBLOCKCOUNT) && defined(DKIOCGETBLOCKSIZE)
+    uint64_t count;
+    uint32_t sector;
+    if (ioctl(fd, DKIOCGETBLOCKCOUNT, &count) != 0 || ioctl(fd, DKIOCGETBLOCKSIZE, &sector) != 0) {
+        return -1;
+    }
+    return (off_t)(count * sector);
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int shred_io_is_device(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && is_device(&st);
+}
+
+int shred_io_zero_range(int fd, off_t offset, off_t length) {
+#if defined(BLKZEROOUT)
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+
+    // Only devices: zeroing a range of a file may just mark it unwritten
+    // and leave the old data on the media
+    if (S_ISBLK(st.st_mode)) {
+        uint64_t range[2] = { (uint64_t)offset, (uint64_t)length };
+        shred_io_count_syscalls(1);
+        return ioctl(fd, BLKZEROOUT, range);
+    }
+#else
+    (void)fd;
+    (void)offset;
+    (void)length;
+#endif
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+static int discard_device(int fd, off_t offset, off_t length) {
+#if defined(BLKSECDISCARD) && defined(BLKDISCARD)
+    uint64_t range[2] = { (uint64_t)offset, (uint64_t)length };
+
+    // Secure discard also erases stale copies the FTL still holds, but few
+    // devices implement it
+    shred_io_count_syscalls(1);
+    if (ioctl(fd, BLKSECDISCARD, range) == 0) {
+        return 0;
+    }
+    if (errno != EOPNOTSUPP && errno != EINVAL) {
+        return -1;
+    }
+    shred_io_count_syscalls(1);
+    return ioctl(fd, BLKDISCARD, range);
+#else
+    (void)fd;
+    (void)offset;
+    (void)length;
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+static int punch_hole(int fd, off_t offset, off_t length) {
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+    return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length);
+#elif defined(F_PUNCHHOLE)
+    struct fpunchhole hole = { 0, 0, offset, length };
+    return fcntl(fd, F_PUNCHHOLE, &hole);
+#else
+    (void)fd;
+    (void)offset;
+    (void)length;
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+int shred_io_discard(int fd, off_t offset, off_t length) {
+    struct stat st;
+
+    if (length <= 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+
+    if (!is_device(&st)) {
+        shred_io_count_syscalls(1);
+        return punch_hole(fd, offset, length);
+    }
+    return discard_device(fd, offset, length);
+}
+
+double shred_io_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+uint64_t shred_io_syscalls(void) {
+    return atomic_load_explicit(&syscall_count, memory_order_relaxed);
+}
+
+void shred_io_count_syscalls(uint64_t count) {
+    atomic_fetch_add_explicit(&syscall_count, count, memory_order_relaxed);
+    thread_syscalls += count;
+}
+
+uint64_t shred_io_thread_syscalls(void) {
+    return thread_syscalls;
+}
+
+uint64_t shred_io_thread_short_writes(void) {
+    return thread_short_writes;
+}
+
+void shred_io_count_short_write(void) {
+    thread_short_writes++;
+}
@@ -0,0 +1,148 @@
+#ifndef SHRED_IO_H
+#define SHRED_IO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "shred_stats.h"
+#include "shred_commit.h"
+#include "shred_throttle.h"
+
+// Default size of the buffer each pass is streamed through
+#define SHRED_BUFFER_SIZE (4 * 1024 * 1024)
+
+// Writes kept in flight per descriptor by the uring backend
+#define SHRED_QUEUE_DEPTH 8
+#define SHRED_MAX_QUEUE_DEPTH 64
+
+// Part of a file the mmap backend maps at a time. Mapping a window costs
+// about as much as a pass over it, so windows are as large as the address
+// space comfortably allows and are kept from one pass to the next.
+#if UINTPTR_MAX > 0xFFFFFFFFu
+#define SHRED_MAP_WINDOW ((off_t)1 << 30)
+#else
+#define SHRED_MAP_WINDOW ((off_t)64 << 20)
+#endif
+
+// Keystream generated per streaming copy by the mmap backend, small enough
+// to stay in cache between being generated and stored
+#define SHRED_MAP_STAGE_SIZE (256 * 1024)
+
+typedef enum {
+    SHRED_BACKEND_STDIO,   // fseeko/fwrite through a FILE* (the original path)
+    SHRED_BACKEND_PWRITE,  // positional writes straight on the descriptor
+    SHRED_BACKEND_DIRECT,  // pwrite with O_DIRECT (F_NOCACHE on macOS)
+    SHRED_BACKEND_URING,   // O_DIRECT writes queued on io_uring, pwrite when unavailable
+    SHRED_BACKEND_MMAP     // streaming stores into mapped windows, pwrite for devices and sparse files
+} ShredBackend;
+
+// A page-aligned buffer handed out by the process-wide pool
+typedef struct {
+    unsigned char* data;
+    size_t size;
+} ShredBuffer;
+
+typedef struct ShredRing ShredRing;
+
+typedef struct {
+    ShredBackend backend;
+    int fd;
+    FILE* fp;
+    size_t alignment;
+    int direct;              // O_DIRECT is set on fd right now
+    int use_direct;          // writes and reads go around the page cache wherever aligned
+    ShredBuffer buffers[SHRED_MAX_QUEUE_DEPTH];
+    unsigned int buffer_count;
+    unsigned int next_buffer;
+    ShredRing* ring;
+    unsigned char* map;      // current window of the mmap backend
+    off_t map_offset;
+    size_t map_length;
+    off_t map_limit;         // file size when the writer was opened
+    ShredStats* stats;       // latency histograms, NULL when not instrumented
+    ShredStatsStage* stage;  // where call times and reads are added, may be NULL
+    ShredCommitGroup* commit;  // batches syncs with other files, may be NULL
+    ShredThrottle* throttle;   // limits the rate of writes and reads, may be NULL
+} ShredWriter;
+
+const char* shred_backend_name(ShredBackend backend);
+int shred_backend_from_name(const char* name, ShredBackend* backend);
+
+// Buffers are at least size bytes, page aligned and backed by huge pages
+// when the system has them. Released buffers are kept for reuse.
+int shred_buffer_acquire(ShredBuffer* buffer, size_t size);
+void shred_buffer_release(ShredBuffer* buffer);
+
+// Rounds requested (or SHRED_BUFFER_SIZE when 0) up to a multiple of the
+// file system block size of fd, or of the physical sector size when fd is
+// a disk.
+size_t shred_io_block_size(int fd, size_t requested);
+
+// The writer borrows fd; shred_writer_close never closes it. It owns
+// block_size buffers, one per write it can keep in flight (queue_depth
+// for the uring backend, one otherwise). A uring writer that cannot get a
+// ring falls back to the pwrite backend, and so does an mmap writer on
+// anything but a fully allocated regular file opened for reading and
+// writing, or once a window cannot be mapped.
+int shred_writer_open(ShredWriter* writer, int fd, ShredBackend backend, size_t block_size,
+                      unsigned int queue_depth);
+
+// Returns a writer buffer that no queued write references any more
+unsigned char* shred_writer_buffer(ShredWriter* writer);
+
+// Writes length bytes at offset. Queued backends may return before the
+// data has been written; the buffer must then stay untouched until it is
+// handed out again by shred_writer_buffer or shred_writer_drain returns.
+// With a throttle, writes and reads first wait for its limits and write
+// latency is reported to it.
+int shred_writer_write(ShredWriter* writer, const void* buffer, size_t length, off_t offset);
+int shred_writer_read(ShredWriter* writer, void* buffer, size_t length, off_t offset);
+int shred_writer_drain(ShredWriter* writer);
+int shred_writer_flush(ShredWriter* writer);
+
+// Flushes the writer and forces what it wrote to stable storage, through
+// the writer's commit group when it has one
+int shred_writer_sync(ShredWriter* writer);
+void shred_writer_close(ShredWriter* writer);
+
+// Forces written data to stable storage (F_FULLFSYNC on macOS)
+int shred_io_sync(int fd);
+
+// Asks the kernel to forget cached pages of the range, so later reads
+// come from the device. Best effort.
+void shred_io_drop_cache(int fd, off_t offset, off_t length);
+
+// Size of a regular file, or of a whole disk (BLKGETSIZE64, or the block
+// count on macOS); -1 on error
+off_t shred_io_size(int fd);
+
+// True for block devices (and raw disks on macOS)
+int shred_io_is_device(int fd);
+
+// Has a block device zero the range itself (BLKZEROOUT, which writes
+// rather than unmaps). Fails with EOPNOTSUPP on files and on devices
+// without the offload.
+int shred_io_zero_range(int fd, off_t offset, off_t length);
+
+// Hands the blocks behind the range back to the device: BLKSECDISCARD
+// (or BLKDISCARD) on block devices, a punched hole on files (F_PUNCHHOLE
+// on macOS), which the file system passes on as TRIM when mounted with
+// discard. Fails with EOPNOTSUPP where neither is available.
+int shred_io_discard(int fd, off_t offset, off_t length);
+
+double shred_io_now(void);
+
+// System calls the engine has issued for file I/O (writes, reads, syncs,
+// ring submissions, discards), summed over every thread; benchmarks read
+// it before and after a run. Buffered stdio writes count once per call.
+uint64_t shred_io_syscalls(void);
+void shred_io_count_syscalls(uint64_t count);
+
+// The same count, and the number of writes the kernel only partly
+// completed, for the calling thread alone
+uint64_t shred_io_thread_syscalls(void);
+uint64_t shred_io_thread_short_writes(void);
+void shred_io_count_short_write(void);
+
+#endif /* SHRED_IO_H */
@@ -0,0 +1,402 @@
+#define _GNU_SOURCE
+#include "shred_journal.h"
+#include "shred_io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/crypto.h>
+
+#define JOURNAL_MAGIC 0x315a594aU  // "JYZ1"
+
+#define RECORD_JOB 1
+#define RECORD_RANGE 2
+
+// Nonces that still fit the 16-bit record length
+#define JOURNAL_MAX_PASSES 1024
+
+typedef struct {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t length;    // payload bytes that follow
+    uint64_t checksum;  // over type, length and payload
+} RecordHeader;
+
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    int64_t size;
+    uint32_t algorithm;
+    uint32_t pass_count;
+    unsigned char key[SHRED_KEY_SIZE];
+    // followed by pass_count nonces
+} JobRecord;
+
+typedef struct {
+    uint32_t pass;
+    uint32_t reserved;
+    int64_t start;
+    int64_t end;
+} RangeRecord;
+
+// FNV-1a; it only has to notice torn and half-written records
+static uint64_t checksum(uint64_t hash, const void* data, size_t length) {
+    const unsigned char* bytes = data;
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t record_checksum(uint16_t type, uint16_t length, const void* payload) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    hash = checksum(hash, &type, sizeof(type));
+    hash = checksum(hash, &length, sizeof(length));
+    return checksum(hash, payload, length);
+}
+
+// Appends one record to buffer and returns the bytes it took
+static size_t put_record(unsigned char* buffer, uint16_t type, const void* payload, uint16_t length) {
+    RecordHeader header = { JOURNAL_MAGIC, type, length, record_checksum(type, length, payload) };
+
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer + sizeof(header), payload, length);
+    return sizeof(header) + length;
+}
+
+// Writes length bytes at the end of the journal and makes them durable
+static int append(ShredJournal* journal, const unsigned char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(journal->fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+
+    return shred_io_sync(journal->fd);
+}
+
+static void identify(const struct stat* st, uint64_t* device, uint64_t* inode) {
+    if (S_ISBLK(st->st_mode) || S_ISCHR(st->st_mode)) {
+        // Device nodes get new inodes every boot; the device number stays
+        *device = (uint64_t)st->st_rdev;
+        *inode = 0;
+    } else {
+        *device = (uint64_t)st->st_dev;
+        *inode = (uint64_t)st->st_ino;
+    }
+}
+
+static int load_job(ShredJournal* journal, const unsigned char* payload, size_t length) {
+    JobRecord job;
+
+    if (length < sizeof(job)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(&job, payload, sizeof(job));
+    if (job.pass_count == 0 || job.pass_count > JOURNAL_MAX_PASSES ||
+        length != sizeof(job) + job.pass_count * SHRED_NONCE_SIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    journal->nonces = calloc(job.pass_count, SHRED_NONCE_SIZE);
+    journal->done = calloc(job.pass_count, sizeof(*journal->done));
+    journal->done_count = calloc(job.pass_count, sizeof(*journal->done_count));
+    if (!journal->nonces || !journal->done || !journal->done_count) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    journal->device = job.device;
+    journal->inode = job.inode;
+    journal->size = (off_t)job.size;
+    journal->algorithm = job.algorithm;
+    journal->pass_count = job.pass_count;
+    memcpy(journal->key, job.key, sizeof(journal->key));
+    memcpy(journal->nonces, payload + sizeof(job), job.pass_count * SHRED_NONCE_SIZE);
+    OPENSSL_cleanse(&job, sizeof(job));
+    journal->loaded = 1;
+    return 0;
+}
+
+static int load_range(ShredJournal* journal, const unsigned char* payload, size_t length) {
+    RangeRecord range;
+
+    if (!journal->loaded || length != sizeof(range)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(&range, payload, sizeof(range));
+    if (range.pass >= journal->pass_count || range.start < 0 || range.end <= range.start) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Merged once everything is read
+    ShredExtent** done = &journal->done[range.pass];
+    size_t count = journal->done_count[range.pass];
+    ShredExtent* larger = realloc(*done, (count + 1) * sizeof(ShredExtent));
+    if (!larger) {
+        errno = ENOMEM;
+        return -1;
+    }
+    larger[count].start = (off_t)range.start;
+    larger[count].end = (off_t)range.end;
+    *done = larger;
+    journal->done_count[range.pass] = count + 1;
+    return 0;
+}
+
+// Reads every intact record and cuts off whatever follows the last one
+static int load(ShredJournal* journal) {
+    struct stat st;
+
+    if (fstat(journal->fd, &st) != 0) {
+        return -1;
+    }
+    if (st.st_size == 0) {
+        return 0;
+    }
+
+    unsigned char* data = malloc((size_t)st.st_size);
+    if (!data) {
+        errno = ENOMEM;
+        return -1;
+    }
+    size_t length = 0;
+    while (length < (size_t)st.st_size) {
+        ssize_t got = pread(journal->fd, data + length, (size_t)st.st_size - length, (off_t)length);
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        length += (size_t)got;
+    }
+
+    size_t position = 0;
+    while (position + sizeof(RecordHeader) <= length) {
+        RecordHeader header;
+        memcpy(&header, data + position, sizeof(header));
+        errno = EINVAL;
+
+        const unsigned char* payload = data + position + sizeof(header);
+        if (header.magic != JOURNAL_MAGIC || header.length > length - position - sizeof(header) ||
+            header.checksum != record_checksum(header.type, header.length, payload)) {
+            break;
+        }
+
+        int status = -1;
+        if (header.type == RECORD_JOB && !journal->loaded) {
+            status = load_job(journal, payload, header.length);
+        } else if (header.type == RECORD_RANGE) {
+            status = load_range(journal, payload, header.length);
+        }
+        if (status != 0) {
+            break;
+        }
+        position += sizeof(header) + header.length;
+    }
+    int error = position < length ? errno : 0;
+    OPENSSL_cleanse(data, length);
+    free(data);
+
+    // Running short of memory says nothing about the records
+    if (error == ENOMEM) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (size_t pass = 0; pass < journal->pass_count; pass++) {
+        journal->done_count[pass] = shred_extent_normalize(journal->done[pass], journal->done_count[pass]);
+    }
+
+    // New records must follow the last intact one, not the torn tail
+    if ((off_t)position < st.st_size && ftruncate(journal->fd, (off_t)position) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Makes the journal's own directory entry durable
+static void sync_parent(const char* path) {
+    const char* slash = strrchr(path, '/');
+    char* parent = slash ? strndup(path, slash == path ? 1 : (size_t)(slash - path)) : strdup(".");
+    if (!parent) {
+        return;
+    }
+
+    int fd = open(parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(parent);
+}
+
+int shred_journal_open(ShredJournal* journal, const char* path, int resume) {
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (journal->fd < 0) {
+        return -1;
+    }
+    pthread_mutex_init(&journal->lock, NULL);
+
+    struct stat st;
+    int status = fstat(journal->fd, &st);
+    if (status == 0 && !resume && st.st_size > 0) {
+        errno = EEXIST;
+        status = -1;
+    } else if (status == 0 && resume) {
+        status = load(journal);
+    }
+
+    if (status != 0) {
+        int saved_errno = errno;
+        shred_journal_close(journal);
+        errno = saved_errno;
+        return -1;
+    }
+    if (st.st_size == 0) {
+        sync_parent(path);
+    }
+    return 0;
+}
+
+void shred_journal_close(ShredJournal* journal) {
+    if (journal->fd < 0) {
+        return;
+    }
+
+    close(journal->fd);
+    journal->fd = -1;
+    pthread_mutex_destroy(&journal->lock);
+
+    for (size_t pass = 0; journal->done && pass < journal->pass_count; pass++) {
+        free(journal->done[pass]);
+    }
+    free(journal->done);
+    free(journal->done_count);
+    if (journal->nonces) {
+        OPENSSL_cleanse(journal->nonces, journal->pass_count * SHRED_NONCE_SIZE);
+    }
+    free(journal->nonces);
+    OPENSSL_cleanse(journal->key, sizeof(journal->key));
+}
+
+int shred_journal_begin(ShredJournal* journal, int fd, off_t size, unsigned int algorithm,
+                        size_t pass_count, unsigned char* key, unsigned char (*nonces)[SHRED_NONCE_SIZE]) {
+    struct stat st;
+    uint64_t device, inode;
+
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    identify(&st, &device, &inode);
+
+    if (journal->loaded) {
+        if (journal->device != device || journal->inode != inode || journal->size != size ||
+            journal->algorithm != algorithm || journal->pass_count != pass_count) {
+            errno = ESTALE;
+            return -1;
+        }
+        memcpy(key, journal->key, SHRED_KEY_SIZE);
+        memcpy(nonces, journal->nonces, pass_count * SHRED_NONCE_SIZE);
+        return 0;
+    }
+
+    if (pass_count == 0 || pass_count > JOURNAL_MAX_PASSES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t length = sizeof(JobRecord) + pass_count * SHRED_NONCE_SIZE;
+    unsigned char* payload = malloc(length);
+    unsigned char* record = malloc(sizeof(RecordHeader) + length);
+    if (!payload || !record) {
+        free(payload);
+        free(record);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    JobRecord job;
+    memset(&job, 0, sizeof(job));
+    job.device = device;
+    job.inode = inode;
+    job.size = (int64_t)size;
+    job.algorithm = algorithm;
+    job.pass_count = (uint32_t)pass_count;
+    memcpy(job.key, key, sizeof(job.key));
+    memcpy(payload, &job, sizeof(job));
+    memcpy(payload + sizeof(job), nonces, pass_count * SHRED_NONCE_SIZE);
+
+    pthread_mutex_lock(&journal->lock);
+    int status = append(journal, record, put_record(record, RECORD_JOB, payload, (uint16_t)length));
+    pthread_mutex_unlock(&journal->lock);
+
+    OPENSSL_cleanse(&job, sizeof(job));
+    OPENSSL_cleanse(payload, length);
+    OPENSSL_cleanse(record, sizeof(RecordHeader) + length);
+    free(payload);
+    free(record);
+    return status;
+}
+
+const ShredExtent* shred_journal_done(const ShredJournal* journal, size_t pass, size_t* count) {
+    if (!journal->loaded || pass >= journal->pass_count) {
+        *count = 0;
+        return NULL;
+    }
+
+    *count = journal->done_count[pass];
+    return journal->done[pass];
+}
+
+uint64_t shred_journal_done_bytes(const ShredJournal* journal) {
+    uint64_t total = 0;
+
+    for (size_t pass = 0; journal->loaded && pass < journal->pass_count; pass++) {
+        total += (uint64_t)shred_extent_bytes(journal->done[pass], journal->done_count[pass]);
+    }
+    return total;
+}
+
+int shred_journal_record(ShredJournal* journal, size_t pass, const ShredExtent* ranges, size_t count) {
+    size_t record_size = sizeof(RecordHeader) + sizeof(RangeRecord);
+    size_t length = 0;
+
+    if (count == 0) {
+        return 0;
+    }
+    unsigned char* records = malloc(count * record_size);
+    if (!records) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        RangeRecord range = { (uint32_t)pass, 0, (int64_t)ranges[i].start, (int64_t)ranges[i].end };
+        length += put_record(records + length, RECORD_RANGE, &range, sizeof(range));
+    }
+
+    // One write and one sync for every range of the checkpoint
+    pthread_mutex_lock(&journal->lock);
+    int status = append(journal, records, length);
+    pthread_mutex_unlock(&journal->lock);
+
+    free(records);
+    return status;
+}
@@ -0,0 +1,59 @@
+#ifndef SHRED_JOURNAL_H
+#define SHRED_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "shred_extent.h"
+#include "shred_keystream.h"
+
+// Seconds of work a worker does between checkpoints; a crash loses at
+// most this much of a pass
+#define SHRED_JOURNAL_INTERVAL 10.0
+
+// Checkpoint journal of one long shred. It is append-only: a job record
+// with what identifies the target and the generator key and pass nonces,
+// then a record per byte range whose pass data has reached stable
+// storage. Every record carries a checksum, so the torn tail a crash
+// leaves behind is recognised and dropped when the journal is read back.
+typedef struct {
+    int fd;
+    pthread_mutex_t lock;
+    int loaded;                  // a job record was read back
+    uint64_t device;             // the disk's device number, or the file's file system
+    uint64_t inode;              // the file's inode, 0 for a disk
+    off_t size;
+    unsigned int algorithm;
+    size_t pass_count;
+    unsigned char key[SHRED_KEY_SIZE];
+    unsigned char (*nonces)[SHRED_NONCE_SIZE];
+    ShredExtent** done;          // per pass, sorted and merged
+    size_t* done_count;
+} ShredJournal;
+
+// Opens the journal at path. Without resume it is created and must not
+// already hold records (EEXIST); with resume the records it holds are read
+// back, a missing journal simply starts a new job.
+int shred_journal_open(ShredJournal* journal, const char* path, int resume);
+void shred_journal_close(ShredJournal* journal);
+
+// Binds the journal to the job about to run on fd. A new journal records
+// key and nonces (pass_count of them) durably; one read back checks that
+// it belongs to the same file or disk, size and algorithm (ESTALE
+// otherwise) and replaces key and nonces with the recorded ones, so the
+// passes continue the keystreams they started.
+int shred_journal_begin(ShredJournal* journal, int fd, off_t size, unsigned int algorithm,
+                        size_t pass_count, unsigned char* key, unsigned char (*nonces)[SHRED_NONCE_SIZE]);
+
+// Ranges of pass already durable when the journal was opened
+const ShredExtent* shred_journal_done(const ShredJournal* journal, size_t pass, size_t* count);
+
+// Bytes over every pass already durable when the journal was opened
+uint64_t shred_journal_done_bytes(const ShredJournal* journal);
+
+// Appends ranges of pass, which must already be on stable storage, and
+// syncs the journal. Safe to call from several workers at once.
+int shred_journal_record(ShredJournal* journal, size_t pass, const ShredExtent* ranges, size_t count);
+
+#endif /* SHRED_JOURNAL_H */
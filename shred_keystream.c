@@ -0,0 +1,169 @@
+#include "shred_keystream.h"
+#include <string.h>
+#include <errno.h>
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+// EVP_EncryptUpdate takes an int length
+#define MAX_UPDATE (1 << 30)
+
+static const char* cipher_names[] = { "auto", "aes", "chacha20" };
+
+const char* shred_cipher_name(ShredCipher cipher) {
+    if ((size_t)cipher >= sizeof(cipher_names) / sizeof(cipher_names[0])) {
+        return "unknown";
+    }
+
+    return cipher_names[cipher];
+}
+
+int shred_cipher_from_name(const char* name, ShredCipher* cipher) {
+    for (size_t i = 0; i < sizeof(cipher_names) / sizeof(cipher_names[0]); i++) {
+        if (strcmp(name, cipher_names[i]) == 0) {
+            *cipher = (ShredCipher)i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int cpu_has_aes(void) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes");
+#elif defined(__aarch64__) && defined(__APPLE__)
+    // Every Apple Silicon core has the ARMv8 crypto extensions
+    return 1;
+#elif defined(__aarch64__) && defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#else
+    return 0;
+#endif
+}
+
+ShredCipher shred_cipher_resolve(ShredCipher cipher) {
+    if (cipher != SHRED_CIPHER_AUTO) {
+        return cipher;
+    }
+
+    // OpenSSL picks the widest AES-NI/VAES or AVX2/AVX-512/NEON kernel for
+    // either cipher; without AES instructions ChaCha20 is the faster one
+    static int has_aes = -1;
+    if (has_aes < 0) {
+        has_aes = cpu_has_aes();
+    }
+
+    return has_aes ? SHRED_CIPHER_AES_CTR : SHRED_CIPHER_CHACHA20;
+}
+
+int shred_keystream_init(ShredKeystream* stream, ShredCipher cipher) {
+    memset(stream, 0, sizeof(*stream));
+    stream->cipher = shred_cipher_resolve(cipher);
+    stream->ctx = EVP_CIPHER_CTX_new();
+    if (!stream->ctx) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Moves a big-endian 128-bit CTR counter block forward by blocks
+static void advance_counter_be(unsigned char* iv, uint64_t blocks) {
+    for (int i = 15; i >= 0 && blocks > 0; i--) {
+        uint64_t sum = (uint64_t)iv[i] + (blocks & 0xFF);
+        iv[i] = (unsigned char)sum;
+        blocks = (blocks >> 8) + (sum >> 8);
+    }
+}
+
+// OpenSSL's ChaCha20 IV starts with a little-endian block counter that
+// carries into the following nonce word, so the first 8 bytes act as one
+// 64-bit counter and files past 256 GiB do not wrap
+static void advance_counter_le(unsigned char* iv, uint64_t blocks) {
+    uint64_t counter = 0;
+    for (int i = 7; i >= 0; i--) {
+        counter = (counter << 8) | iv[i];
+    }
+
+    counter += blocks;
+    for (int i = 0; i < 8; i++) {
+        iv[i] = (unsigned char)(counter >> (8 * i));
+    }
+}
+
+int shred_keystream_start(ShredKeystream* stream, const unsigned char* key, const unsigned char* nonce,
+                          uint64_t offset) {
+    unsigned char iv[SHRED_NONCE_SIZE];
+    const EVP_CIPHER* cipher;
+    size_t block;
+
+    memcpy(stream->key, key, SHRED_KEY_SIZE);
+    memcpy(stream->nonce, nonce, SHRED_NONCE_SIZE);
+    memcpy(iv, nonce, sizeof(iv));
+
+    if (stream->cipher == SHRED_CIPHER_CHACHA20) {
+        cipher = EVP_chacha20();
+        block = 64;
+        advance_counter_le(iv, offset / block);
+    } else {
+        cipher = EVP_aes_256_ctr();
+        block = 16;
+        advance_counter_be(iv, offset / block);
+    }
+
+    if (EVP_EncryptInit_ex(stream->ctx, cipher, NULL, key, iv) != 1) {
+        errno = EIO;
+        return -1;
+    }
+
+    // Drop the part of the first block that lies before offset
+    size_t skip = (size_t)(offset % block);
+    if (skip > 0) {
+        unsigned char scratch[64] = { 0 };
+        int outlen;
+        if (EVP_EncryptUpdate(stream->ctx, scratch, &outlen, scratch, (int)skip) != 1) {
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    OPENSSL_cleanse(iv, sizeof(iv));
+    return 0;
+}
+
+int shred_keystream_xor(ShredKeystream* stream, unsigned char* data, size_t length) {
+    while (length > 0) {
+        int chunk = length > MAX_UPDATE ? MAX_UPDATE : (int)length;
+        int outlen;
+
+        if (EVP_EncryptUpdate(stream->ctx, data, &outlen, data, chunk) != 1) {
+            errno = EIO;
+            return -1;
+        }
+
+        data += chunk;
+        length -= (size_t)chunk;
+    }
+
+    return 0;
+}
+
+int shred_keystream_generate(ShredKeystream* stream, unsigned char* out, size_t length) {
+    // The keystream is the encryption of zeros
+    memset(out, 0, length);
+    return shred_keystream_xor(stream, out, length);
+}
+
+void shred_keystream_free(ShredKeystream* stream) {
+    EVP_CIPHER_CTX_free(stream->ctx);
+    OPENSSL_cleanse(stream->key, sizeof(stream->key));
+    OPENSSL_cleanse(stream->nonce, sizeof(stream->nonce));
+    stream->ctx = NULL;
+}
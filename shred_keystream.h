@@ -0,0 +1,47 @@
+#ifndef SHRED_KEYSTREAM_H
+#define SHRED_KEYSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHRED_KEY_SIZE 32
+#define SHRED_NONCE_SIZE 16
+
+typedef enum {
+    SHRED_CIPHER_AUTO,      // AES-CTR when the CPU has AES instructions, ChaCha20 otherwise
+    SHRED_CIPHER_AES_CTR,   // AES-256-CTR
+    SHRED_CIPHER_CHACHA20   // ChaCha20 with a 64-bit block counter
+} ShredCipher;
+
+// Seekable keystream: the bytes produced for a file offset depend only on
+// key, nonce and offset, so any worker can start anywhere in the stream
+// and a verifier can regenerate what a pass wrote.
+typedef struct {
+    ShredCipher cipher;
+    void* ctx;
+    unsigned char key[SHRED_KEY_SIZE];
+    unsigned char nonce[SHRED_NONCE_SIZE];
+} ShredKeystream;
+
+const char* shred_cipher_name(ShredCipher cipher);
+int shred_cipher_from_name(const char* name, ShredCipher* cipher);
+
+// Resolves SHRED_CIPHER_AUTO from the CPU features found at run time
+ShredCipher shred_cipher_resolve(ShredCipher cipher);
+
+// Allocates the cipher context; one generator per worker thread
+int shred_keystream_init(ShredKeystream* stream, ShredCipher cipher);
+
+// Starts a new stream (a pass) positioned at offset
+int shred_keystream_start(ShredKeystream* stream, const unsigned char* key, const unsigned char* nonce,
+                          uint64_t offset);
+
+// Writes the next length keystream bytes to out
+int shred_keystream_generate(ShredKeystream* stream, unsigned char* out, size_t length);
+
+// XORs the next length keystream bytes into data
+int shred_keystream_xor(ShredKeystream* stream, unsigned char* data, size_t length);
+
+void shred_keystream_free(ShredKeystream* stream);
+
+#endif /* SHRED_KEYSTREAM_H */
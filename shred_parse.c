@@ -0,0 +1,48 @@
+#include "shred_parse.h"
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+int shred_parse_size(const char* text, size_t* size) {
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    unsigned int shift = 0;
+
+    switch (*end) {
+        case 'G': case 'g': shift = 30; end++; break;
+        case 'M': case 'm': shift = 20; end++; break;
+        case 'K': case 'k': shift = 10; end++; break;
+        default: break;
+    }
+
+    // strtoull takes "-1" as a huge count; a digit has to come first
+    if (!isdigit((unsigned char)text[0]) || errno == ERANGE || *end != '\0' || value == 0 ||
+        value > (SIZE_MAX >> shift)) {
+        return -1;
+    }
+
+    *size = (size_t)(value << shift);
+    return 0;
+}
+
+int shred_parse_count(const char* text, unsigned int max, unsigned int* count) {
+    char* end;
+    errno = 0;
+    unsigned long value = strtoul(text, &end, 10);
+
+    if (!isdigit((unsigned char)text[0]) || errno == ERANGE || *end != '\0' || value == 0 || value > max) {
+        return -1;
+    }
+
+    *count = (unsigned int)value;
+    return 0;
+}
+
+int shred_parse_number(const char* text, double* value) {
+    char* end;
+    *value = strtod(text, &end);
+    return end == text || *end != '\0' || !isfinite(*value) ? -1 : 0;
+}
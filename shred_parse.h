@@ -0,0 +1,19 @@
+#ifndef SHRED_PARSE_H
+#define SHRED_PARSE_H
+
+#include <stddef.h>
+
+// Option values shared by the command line and the benchmark. Each
+// returns 0 when text is a valid value in full, -1 otherwise.
+
+// A byte count above zero with an optional K, M or G suffix that still
+// fits size_t once the suffix is applied
+int shred_parse_size(const char* text, size_t* size);
+
+// A count between 1 and max
+int shred_parse_count(const char* text, unsigned int max, unsigned int* count);
+
+// A finite number
+int shred_parse_number(const char* text, double* value);
+
+#endif /* SHRED_PARSE_H */
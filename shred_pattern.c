@@ -0,0 +1,154 @@
+#include "shred_pattern.h"
+#include "shred_io.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define TILE_SLOTS 64
+
+typedef struct {
+    unsigned char sequence[SHRED_PATTERN_PERIOD];
+    ShredBuffer buffer;
+    size_t size;
+    unsigned int users;
+    uint64_t last_used;
+} PatternTile;
+
+static PatternTile tiles[TILE_SLOTS];
+static size_t cached_bytes;
+static uint64_t use_clock;
+static pthread_mutex_t tile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void shred_pattern_fill(unsigned char* buffer, size_t length, const unsigned char* pattern,
+                        size_t period, size_t phase) {
+    if (length == 0) {
+        return;
+    }
+
+    // Seed one period, then keep doubling the filled prefix
+    size_t seed = period < length ? period : length;
+    for (size_t i = 0; i < seed; i++) {
+        buffer[i] = pattern[(phase + i) % period];
+    }
+    for (size_t filled = seed; filled < length; ) {
+        size_t copy = filled < length - filled ? filled : length - filled;
+        memcpy(buffer + filled, buffer, copy);
+        filled += copy;
+    }
+}
+
+size_t shred_pattern_tile_size(size_t block_size, size_t alignment) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t granule = SHRED_PATTERN_PERIOD * (alignment > page ? alignment : page);
+
+    if (block_size < granule) {
+        return granule;
+    }
+
+    return block_size / granule * granule;
+}
+
+// Drops the least recently used tile nobody holds; 0 when there is none
+static int evict_oldest(void) {
+    int oldest = -1;
+    for (int i = 0; i < TILE_SLOTS; i++) {
+        if (tiles[i].buffer.data && tiles[i].users == 0 &&
+            (oldest < 0 || tiles[i].last_used < tiles[oldest].last_used)) {
+            oldest = i;
+        }
+    }
+    if (oldest < 0) {
+        return 0;
+    }
+
+    cached_bytes -= tiles[oldest].buffer.size;
+    shred_buffer_release(&tiles[oldest].buffer);
+    memset(&tiles[oldest], 0, sizeof(tiles[oldest]));
+    return 1;
+}
+
+// Makes room for a tile of size bytes and returns its slot, or -1 when
+// every slot is held
+static int free_slot(size_t size) {
+    while (cached_bytes + size > SHRED_PATTERN_CACHE_SIZE && evict_oldest()) {
+    }
+
+    do {
+        for (int i = 0; i < TILE_SLOTS; i++) {
+            if (!tiles[i].buffer.data) {
+                return i;
+            }
+        }
+    } while (evict_oldest());
+
+    return -1;
+}
+
+const unsigned char* shred_pattern_tile_acquire(const unsigned char* pattern, size_t period,
+                                                size_t phase, size_t size) {
+    if (period == 0 || SHRED_PATTERN_PERIOD % period != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Key on the bytes as seen from phase: Gutmann pass 8 at phase 0 is
+    // pass 7 at phase 1, and passes 26-28 repeat 7-9
+    unsigned char sequence[SHRED_PATTERN_PERIOD];
+    shred_pattern_fill(sequence, sizeof(sequence), pattern, period, phase);
+
+    pthread_mutex_lock(&tile_lock);
+    int slot = -1;
+    for (int i = 0; i < TILE_SLOTS; i++) {
+        if (tiles[i].buffer.data && tiles[i].size == size &&
+            memcmp(tiles[i].sequence, sequence, sizeof(sequence)) == 0) {
+            slot = i;
+            break;
+        }
+    }
+
+    if (slot < 0) {
+        slot = free_slot(size);
+        if (slot < 0) {
+            pthread_mutex_unlock(&tile_lock);
+            errno = EBUSY;
+            return NULL;
+        }
+
+        // Built under the lock: the first user pays once, everyone else
+        // waits a few milliseconds instead of building a duplicate
+        PatternTile* tile = &tiles[slot];
+        if (shred_buffer_acquire(&tile->buffer, size) != 0) {
+            pthread_mutex_unlock(&tile_lock);
+            return NULL;
+        }
+        shred_pattern_fill(tile->buffer.data, size, sequence, sizeof(sequence), 0);
+        memcpy(tile->sequence, sequence, sizeof(sequence));
+        tile->size = size;
+        cached_bytes += tile->buffer.size;
+    }
+
+    tiles[slot].users++;
+    tiles[slot].last_used = ++use_clock;
+    const unsigned char* data = tiles[slot].buffer.data;
+    pthread_mutex_unlock(&tile_lock);
+
+    return data;
+}
+
+void shred_pattern_tile_release(const unsigned char* tile) {
+    if (!tile) {
+        return;
+    }
+
+    pthread_mutex_lock(&tile_lock);
+    for (int i = 0; i < TILE_SLOTS; i++) {
+        if (tiles[i].buffer.data == tile) {
+            tiles[i].users--;
+            break;
+        }
+    }
+    while (cached_bytes > SHRED_PATTERN_CACHE_SIZE && evict_oldest()) {
+    }
+    pthread_mutex_unlock(&tile_lock);
+}
@@ -0,0 +1,34 @@
+#ifndef SHRED_PATTERN_H
+#define SHRED_PATTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Every fixed pattern repeats with a period that divides this (the
+// Gutmann MFM/RLL sequences are three bytes long)
+#define SHRED_PATTERN_PERIOD 3
+
+// Tiles kept once nothing uses them, so a whole Gutmann run stays cached
+// at the default block size
+#define SHRED_PATTERN_CACHE_SIZE (128 * 1024 * 1024)
+
+// Fills length bytes of buffer with the period-byte pattern as it appears
+// at a file offset whose phase within the pattern is phase
+void shred_pattern_fill(unsigned char* buffer, size_t length, const unsigned char* pattern,
+                        size_t period, size_t phase);
+
+// Size of the tiles used in place of block_size byte writes: a multiple of
+// SHRED_PATTERN_PERIOD times alignment (the file system block), so
+// consecutive tile-sized writes keep the pattern phase and stay aligned
+// for O_DIRECT
+size_t shred_pattern_tile_size(size_t block_size, size_t alignment);
+
+// Returns a read-only, page-aligned tile of size bytes (from
+// shred_pattern_tile_size) holding the pattern starting at phase. Tiles
+// are built once and shared by every thread; each acquire must be paired
+// with a release once no write references the tile any more.
+const unsigned char* shred_pattern_tile_acquire(const unsigned char* pattern, size_t period,
+                                                size_t phase, size_t size);
+void shred_pattern_tile_release(const unsigned char* tile);
+
+#endif /* SHRED_PATTERN_H */
@@ -0,0 +1,82 @@
+#include "shred_progress.h"
+#include "shred_io.h"
+#include <stdio.h>
+
+// Weight of the newest interval in the smoothed rate
+#define RATE_SMOOTHING 0.3
+
+void shred_progress_init(ShredProgress* progress) {
+    atomic_init(&progress->bytes_done, 0);
+    atomic_init(&progress->bytes_total, 0);
+    atomic_init(&progress->pass_count, 0);
+}
+
+void shred_progress_add_job(ShredProgress* progress, uint64_t bytes, unsigned int pass_count) {
+    atomic_fetch_add_explicit(&progress->bytes_total, bytes, memory_order_relaxed);
+
+    // A pass number only means something while every job has as many,
+    // all crossing the file once per pass
+    unsigned int shown = pass_count > 0 ? pass_count : SHRED_PROGRESS_NO_PASS;
+    unsigned int seen = 0;
+    if (!atomic_compare_exchange_strong_explicit(&progress->pass_count, &seen, shown,
+                                                 memory_order_relaxed, memory_order_relaxed) &&
+        seen != shown) {
+        atomic_store_explicit(&progress->pass_count, SHRED_PROGRESS_NO_PASS, memory_order_relaxed);
+    }
+}
+
+void shred_progress_sample(ShredProgress* progress, ShredProgressSample* sample) {
+    double now = shred_io_now();
+    uint64_t done = atomic_load_explicit(&progress->bytes_done, memory_order_relaxed);
+    uint64_t total = atomic_load_explicit(&progress->bytes_total, memory_order_relaxed);
+    unsigned int pass_count = atomic_load_explicit(&progress->pass_count, memory_order_relaxed);
+    if (pass_count == SHRED_PROGRESS_NO_PASS) {
+        pass_count = 0;
+    }
+
+    if (sample->time > 0.0 && now > sample->time && done >= sample->bytes_done) {
+        double mbps = (double)(done - sample->bytes_done) / (now - sample->time) / 1e6;
+        sample->mbps = sample->mbps > 0.0 ? sample->mbps + RATE_SMOOTHING * (mbps - sample->mbps) : mbps;
+    }
+
+    sample->time = now;
+    sample->bytes_done = done;
+    sample->bytes_total = total;
+    sample->pass_count = pass_count;
+    sample->fraction = total > 0 ? (double)done / (double)total : 0.0;
+    if (sample->fraction > 1.0) {
+        sample->fraction = 1.0;
+    }
+
+    // Every pass covers the same bytes, so the pass follows from the total
+    sample->pass = 1;
+    if (pass_count > 0 && total > 0) {
+        uint64_t per_pass = total / pass_count;
+        sample->pass = per_pass > 0 ? (unsigned int)(done / per_pass) + 1 : 1;
+        if (sample->pass > pass_count) {
+            sample->pass = pass_count;
+        }
+    }
+
+    sample->eta = sample->mbps > 0.0 && total >= done ? (double)(total - done) / (sample->mbps * 1e6) : -1.0;
+}
+
+void shred_progress_format(const ShredProgressSample* sample, char* text, size_t size) {
+    char eta[32] = "--:--";
+
+    if (sample->eta >= 0.0) {
+        unsigned long seconds = (unsigned long)(sample->eta + 0.5);
+        if (seconds >= 3600) {
+            snprintf(eta, sizeof(eta), "%lu:%02lu:%02lu", seconds / 3600, seconds / 60 % 60, seconds % 60);
+        } else {
+            snprintf(eta, sizeof(eta), "%lu:%02lu", seconds / 60, seconds % 60);
+        }
+    }
+
+    char pass[32] = "";
+    if (sample->pass_count > 0) {
+        snprintf(pass, sizeof(pass), "  pass %u/%u", sample->pass, sample->pass_count);
+    }
+
+    snprintf(text, size, "%5.1f%%%s  %.1f MB/s  ETA %s", 100.0 * sample->fraction, pass, sample->mbps, eta);
+}
@@ -0,0 +1,55 @@
+#ifndef SHRED_PROGRESS_H
+#define SHRED_PROGRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+
+// Interval at which the CLI and GUI reporters sample the counters
+#define SHRED_PROGRESS_INTERVAL_MS 200
+
+// pass_count once a job without a pass to show, or jobs with different
+// numbers of passes, have been added
+#define SHRED_PROGRESS_NO_PASS UINT_MAX
+
+// Live counters of one or more running shreds. Workers only add to them
+// with relaxed atomics; a reporter samples them at its own pace, so the
+// data path never waits on a lock or a UI.
+typedef struct {
+    _Atomic uint64_t bytes_done;    // over every pass
+    _Atomic uint64_t bytes_total;   // grows as jobs start
+    _Atomic unsigned int pass_count;  // shared by every job, or SHRED_PROGRESS_NO_PASS
+} ShredProgress;
+
+// What a reporter shows, derived from two consecutive samples
+typedef struct {
+    double time;
+    uint64_t bytes_done;
+    uint64_t bytes_total;
+    double fraction;       // 0.0 - 1.0
+    double mbps;           // smoothed over recent samples
+    double eta;            // seconds left, negative while unknown
+    unsigned int pass;     // 1-based pass most of the data is in
+    unsigned int pass_count;  // 0 when there is no pass to show
+} ShredProgressSample;
+
+void shred_progress_init(ShredProgress* progress);
+
+// Called by the engine when a job starts. pass_count is 0 for a job whose
+// bytes do not follow its passes (pass windows), which shows no pass.
+void shred_progress_add_job(ShredProgress* progress, uint64_t bytes, unsigned int pass_count);
+
+static inline void shred_progress_add(ShredProgress* progress, uint64_t bytes) {
+    atomic_fetch_add_explicit(&progress->bytes_done, bytes, memory_order_relaxed);
+}
+
+// Reads the counters and updates sample, which must be zeroed before the
+// first call and then passed back unchanged each time
+void shred_progress_sample(ShredProgress* progress, ShredProgressSample* sample);
+
+// Formats sample as "42.0%  pass 2/3  812.4 MB/s  ETA 0:17", leaving the
+// pass out when there is none to show
+void shred_progress_format(const ShredProgressSample* sample, char* text, size_t size);
+
+#endif /* SHRED_PROGRESS_H */
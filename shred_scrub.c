@@ -0,0 +1,295 @@
+#define _GNU_SOURCE
+#include "shred_scrub.h"
+#include "shred_io.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/rand.h>
+
+// Random names are drawn from characters every file system accepts
+static const char name_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+
+// Tries per round to find a random name no other entry has
+#define NAME_ATTEMPTS 8
+
+void shred_scrub_init(ShredScrubBatch* batch, int dirfd) {
+    batch->dirfd = dirfd;
+    pthread_mutex_init(&batch->lock, NULL);
+    batch->entries = NULL;
+    batch->count = 0;
+    batch->removed = 0;
+    batch->directories = 0;
+    batch->failed = 0;
+}
+
+static int random_name(char* name, size_t length) {
+    unsigned char bytes[NAME_MAX];
+
+    if (length > sizeof(bytes) || RAND_bytes(bytes, (int)length) != 1) {
+        return -1;
+    }
+    for (size_t i = 0; i < length; i++) {
+        name[i] = name_alphabet[bytes[i] % (sizeof(name_alphabet) - 1)];
+    }
+    name[length] = '\0';
+    return 0;
+}
+
+// renameat that fails with EEXIST instead of replacing another entry
+static int rename_exclusive(int dirfd, const char* from, const char* to) {
+#if defined(__linux__) && defined(RENAME_NOREPLACE)
+    if (renameat2(dirfd, from, dirfd, to, RENAME_NOREPLACE) == 0) {
+        return 0;
+    }
+    if (errno != EINVAL) {
+        return -1;
+    }
+#elif defined(__APPLE__) && defined(RENAME_EXCL)
+    return renameatx_np(dirfd, from, dirfd, to, RENAME_EXCL);
+#endif
+
+    // File systems without an exclusive rename: look first
+    struct stat st;
+    if (fstatat(dirfd, to, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    return renameat(dirfd, from, dirfd, to);
+}
+
+// Moves the entry current through random names of its length, leaving
+// the last one in current, then drops its size and timestamps. Best
+// effort: whatever fails, the entry is still removed.
+static void scrub_entry(int dirfd, char* current, ShredScrubType type) {
+    size_t length = strlen(current);
+
+    for (int round = 0; round < SHRED_SCRUB_ROUNDS; round++) {
+        char next[NAME_MAX + 1];
+        int renamed = 0;
+
+        // Short names in crowded directories may take a few draws
+        for (int attempt = 0; attempt < NAME_ATTEMPTS && !renamed; attempt++) {
+            if (random_name(next, length) != 0) {
+                break;
+            }
+            shred_io_count_syscalls(1);
+            if (rename_exclusive(dirfd, current, next) == 0) {
+                memcpy(current, next, length + 1);
+                renamed = 1;
+            } else if (errno != EEXIST) {
+                break;
+            }
+        }
+        if (!renamed) {
+            break;
+        }
+    }
+
+    // Nothing is left for the inode to say about the file's size or age
+    static const struct timespec epoch[2] = { { 0, 0 }, { 0, 0 } };
+    if (type != SHRED_SCRUB_FILE) {
+        shred_io_count_syscalls(1);
+        utimensat(dirfd, current, epoch, AT_SYMLINK_NOFOLLOW);
+        return;
+    }
+
+    int fd = openat(dirfd, current, O_WRONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd >= 0) {
+        shred_io_count_syscalls(2);
+        if (ftruncate(fd, 0) == 0) {
+            shred_io_count_syscalls(1);
+            futimens(fd, epoch);
+        }
+        close(fd);
+    }
+}
+
+static void report_failure(const ShredScrubEntry* entry) {
+    switch (entry->type) {
+        case SHRED_SCRUB_FILE:
+            fprintf(stderr, "Error: Unable to delete the file %s.\n", entry->path);
+            break;
+        case SHRED_SCRUB_LINK:
+            fprintf(stderr, "Error: Unable to remove the link %s.\n", entry->path);
+            break;
+        case SHRED_SCRUB_DIRECTORY:
+            fprintf(stderr, "Error: Unable to remove the directory %s.\n", entry->path);
+            break;
+    }
+}
+
+static void scrub_entries(ShredScrubBatch* batch, ShredScrubEntry* entries, size_t count) {
+    // Where the names cannot be copied they are unlinked as they are
+    char (*current)[NAME_MAX + 1] = malloc(count * sizeof(*current));
+    for (size_t i = 0; i < count && current; i++) {
+        snprintf(current[i], sizeof(current[i]), "%s", entries[i].name);
+        scrub_entry(batch->dirfd, current[i], entries[i].type);
+    }
+
+    // One sync for the whole batch puts the random names on the disk in
+    // place of the real ones before any entry goes away
+    if (current) {
+        shred_io_sync(batch->dirfd);
+    }
+
+    uint64_t removed = 0;
+    uint64_t directories = 0;
+    uint64_t failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char* name = current ? current[i] : entries[i].name;
+        int directory = entries[i].type == SHRED_SCRUB_DIRECTORY;
+
+        shred_io_count_syscalls(1);
+        if (unlinkat(batch->dirfd, name, directory ? AT_REMOVEDIR : 0) == 0) {
+            removed += entries[i].type == SHRED_SCRUB_FILE;
+            directories += directory;
+        } else {
+            // Whatever is left stays where its owner can find it
+            if (strcmp(name, entries[i].name) != 0) {
+                shred_io_count_syscalls(1);
+                rename_exclusive(batch->dirfd, name, entries[i].name);
+            }
+            report_failure(&entries[i]);
+            failed++;
+        }
+        free(entries[i].path);
+    }
+    free(current);
+    free(entries);
+
+    pthread_mutex_lock(&batch->lock);
+    batch->removed += removed;
+    batch->directories += directories;
+    batch->failed += failed;
+    pthread_mutex_unlock(&batch->lock);
+}
+
+// Takes the queued entries out of the batch; called with the lock held
+static ShredScrubEntry* take_entries(ShredScrubBatch* batch, size_t* count) {
+    ShredScrubEntry* entries = batch->entries;
+
+    *count = batch->count;
+    batch->entries = NULL;
+    batch->count = 0;
+    return entries;
+}
+
+void shred_scrub_add(ShredScrubBatch* batch, char* path, const char* name, ShredScrubType type) {
+    ShredScrubEntry* full = NULL;
+    size_t count = 0;
+    int queued = 0;
+
+    pthread_mutex_lock(&batch->lock);
+    if (!batch->entries) {
+        batch->entries = malloc(SHRED_SCRUB_BATCH * sizeof(ShredScrubEntry));
+    }
+    if (batch->entries) {
+        batch->entries[batch->count].path = path;
+        batch->entries[batch->count].name = name;
+        batch->entries[batch->count].type = type;
+        batch->count++;
+        queued = 1;
+        // Scrubbed outside the lock while other threads start a new batch
+        if (batch->count == SHRED_SCRUB_BATCH) {
+            full = take_entries(batch, &count);
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    if (full) {
+        scrub_entries(batch, full, count);
+    } else if (!queued) {
+        // Out of memory: a batch of its own
+        ShredScrubEntry* single = malloc(sizeof(ShredScrubEntry));
+        ShredScrubEntry entry = { path, name, type };
+        if (single) {
+            *single = entry;
+            scrub_entries(batch, single, 1);
+        } else {
+            report_failure(&entry);
+            free(path);
+            pthread_mutex_lock(&batch->lock);
+            batch->failed++;
+            pthread_mutex_unlock(&batch->lock);
+        }
+    }
+}
+
+void shred_scrub_flush(ShredScrubBatch* batch) {
+    size_t count;
+
+    pthread_mutex_lock(&batch->lock);
+    ShredScrubEntry* queued = take_entries(batch, &count);
+    pthread_mutex_unlock(&batch->lock);
+
+    if (count > 0) {
+        scrub_entries(batch, queued, count);
+    } else {
+        free(queued);
+    }
+}
+
+void shred_scrub_destroy(ShredScrubBatch* batch) {
+    shred_scrub_flush(batch);
+    pthread_mutex_destroy(&batch->lock);
+}
+
+static int scrub_single(int dirfd, const char* path, ShredScrubType type) {
+    // "dir/" names dir; the slash must not be taken for the parent's
+    size_t length = strlen(path);
+    while (length > 1 && path[length - 1] == '/') {
+        length--;
+    }
+    char* copy = strndup(path, length);
+    if (!copy) {
+        return -1;
+    }
+    path = copy;
+
+    const char* slash = strrchr(path, '/');
+    int parent = -1;
+
+    // The batch works on the directory that holds the file
+    if (slash) {
+        char* directory = strndup(path, (size_t)(slash - path + 1));
+        if (!directory) {
+            free(copy);
+            return -1;
+        }
+        parent = openat(dirfd, directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        free(directory);
+    } else {
+        parent = dirfd == AT_FDCWD ? open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) : dup(dirfd);
+    }
+    if (parent < 0) {
+        int saved_errno = errno;
+        free(copy);
+        errno = saved_errno;
+        return -1;
+    }
+
+    ShredScrubBatch batch;
+    shred_scrub_init(&batch, parent);
+    shred_scrub_add(&batch, copy, slash ? slash + 1 : copy, type);
+    shred_scrub_destroy(&batch);
+    close(parent);
+
+    if (batch.failed > 0) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+int shred_scrub_file(int dirfd, const char* path) {
+    return scrub_single(dirfd, path, SHRED_SCRUB_FILE);
+}
+
+int shred_scrub_directory(int dirfd, const char* path) {
+    return scrub_single(dirfd, path, SHRED_SCRUB_DIRECTORY);
+}
@@ -0,0 +1,65 @@
+#ifndef SHRED_SCRUB_H
+#define SHRED_SCRUB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Random names every entry goes through before it is unlinked
+#define SHRED_SCRUB_ROUNDS 3
+
+// Entries scrubbed per directory sync
+#define SHRED_SCRUB_BATCH 256
+
+typedef enum {
+    SHRED_SCRUB_FILE,       // also truncated to zero before it is unlinked
+    SHRED_SCRUB_LINK,       // never followed
+    SHRED_SCRUB_DIRECTORY   // has to be empty by the time the batch is scrubbed
+} ShredScrubType;
+
+typedef struct {
+    char* path;        // for messages, owned by the batch
+    const char* name;  // the last component of path
+    ShredScrubType type;
+} ShredScrubEntry;
+
+// Entries of one directory waiting to have their name and metadata
+// scrubbed before they are removed. Entries are added by any number of
+// threads; whoever fills the batch scrubs it while the others keep adding
+// to a fresh one.
+typedef struct {
+    int dirfd;
+    pthread_mutex_t lock;
+    ShredScrubEntry* entries;  // room for SHRED_SCRUB_BATCH, allocated by the first add
+    size_t count;
+    uint64_t removed;      // files unlinked so far
+    uint64_t directories;  // directories removed so far
+    uint64_t failed;       // entries of any type that could not be removed
+} ShredScrubBatch;
+
+// The batch borrows dirfd, which has to stay open until it is destroyed
+void shred_scrub_init(ShredScrubBatch* batch, int dirfd);
+
+// Queues name (inside the batch's directory; path names it for messages
+// and is taken over). A full batch is scrubbed in the calling thread.
+void shred_scrub_add(ShredScrubBatch* batch, char* path, const char* name, ShredScrubType type);
+
+// Scrubs what is queued. Every entry is renamed SHRED_SCRUB_ROUNDS times
+// to random names of the same length (never over an existing entry),
+// files are truncated to zero, and every entry gets zero timestamps; the
+// directory is synced once, so only the last random names can reach the
+// disk, and the entries are then removed. One that cannot be removed
+// gets its own name back. Failures are reported on stderr.
+void shred_scrub_flush(ShredScrubBatch* batch);
+
+// Flushes what is left
+void shred_scrub_destroy(ShredScrubBatch* batch);
+
+// Scrubs and unlinks the single file path (relative to dirfd, which may be
+// AT_FDCWD) through a batch of one on its parent directory
+int shred_scrub_file(int dirfd, const char* path);
+
+// shred_scrub_file for an empty directory
+int shred_scrub_directory(int dirfd, const char* path);
+
+#endif /* SHRED_SCRUB_H */
@@ -0,0 +1,150 @@
+#include "shred_stats.h"
+#include <string.h>
+#include <time.h>
+
+#define NS_PER_SECOND 1e9
+
+static uint64_t load(_Atomic uint64_t* counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+void shred_stats_init(ShredStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->started = (double)shred_stats_clock() / NS_PER_SECOND;
+}
+
+static uint64_t read_clock(clockid_t clock) {
+    struct timespec ts;
+
+    if (clock_gettime(clock, &ts) != 0) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t shred_stats_clock(void) {
+    return read_clock(CLOCK_MONOTONIC);
+}
+
+uint64_t shred_stats_cpu_clock(void) {
+    return read_clock(CLOCK_THREAD_CPUTIME_ID);
+}
+
+ShredStatsStage* shred_stats_pass(ShredStats* stats, size_t pass, size_t pass_count) {
+    unsigned int count = (unsigned int)(pass_count < SHRED_STATS_MAX_PASSES ? pass_count : SHRED_STATS_MAX_PASSES);
+    unsigned int seen = atomic_load_explicit(&stats->pass_count, memory_order_relaxed);
+
+    while (seen < count &&
+           !atomic_compare_exchange_weak_explicit(&stats->pass_count, &seen, count,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+
+    return &stats->passes[pass < SHRED_STATS_MAX_PASSES ? pass : SHRED_STATS_MAX_PASSES - 1];
+}
+
+void shred_histogram_record(ShredHistogram* histogram, uint64_t ns) {
+    uint64_t us = ns / 1000;
+    unsigned int bucket = 0;
+
+    while (us > 0 && bucket < SHRED_STATS_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+
+    shred_stats_add(&histogram->counts[bucket], 1);
+    shred_stats_add(&histogram->total_ns, ns);
+
+    uint64_t max = load(&histogram->max_ns);
+    while (ns > max &&
+           !atomic_compare_exchange_weak_explicit(&histogram->max_ns, &max, ns,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static double bucket_edge(unsigned int bucket) {
+    return (double)(1ULL << bucket);
+}
+
+double shred_histogram_quantile(ShredHistogram* histogram, double q) {
+    uint64_t counts[SHRED_STATS_BUCKETS];
+    uint64_t total = 0;
+
+    for (unsigned int i = 0; i < SHRED_STATS_BUCKETS; i++) {
+        counts[i] = load(&histogram->counts[i]);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0.0;
+    }
+
+    // The top bucket's edge can lie far beyond the slowest call seen
+    double max = (double)load(&histogram->max_ns) / 1000.0;
+    uint64_t rank = (uint64_t)(q * (double)total);
+    uint64_t seen = 0;
+    unsigned int bucket = 0;
+    while (bucket < SHRED_STATS_BUCKETS - 1 && seen + counts[bucket] <= rank) {
+        seen += counts[bucket++];
+    }
+    return bucket_edge(bucket) < max ? bucket_edge(bucket) : max;
+}
+
+static void write_stage(FILE* fp, ShredStatsStage* stage) {
+    fprintf(fp, "\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f,\"generate_seconds\":%.6f,"
+            "\"write_seconds\":%.6f,\"read_seconds\":%.6f,\"flush_seconds\":%.6f,"
+            "\"bytes_written\":%llu,\"bytes_read\":%llu,\"syscalls\":%llu,"
+            "\"short_writes\":%llu,\"errors\":%llu}",
+            (double)load(&stage->wall_ns) / NS_PER_SECOND, (double)load(&stage->cpu_ns) / NS_PER_SECOND,
+            (double)load(&stage->generate_ns) / NS_PER_SECOND, (double)load(&stage->write_ns) / NS_PER_SECOND,
+            (double)load(&stage->read_ns) / NS_PER_SECOND, (double)load(&stage->flush_ns) / NS_PER_SECOND,
+            (unsigned long long)load(&stage->bytes_written), (unsigned long long)load(&stage->bytes_read),
+            (unsigned long long)load(&stage->syscalls), (unsigned long long)load(&stage->short_writes),
+            (unsigned long long)load(&stage->errors));
+}
+
+static void write_histogram(FILE* fp, ShredHistogram* histogram) {
+    uint64_t count = 0;
+    for (unsigned int i = 0; i < SHRED_STATS_BUCKETS; i++) {
+        count += load(&histogram->counts[i]);
+    }
+
+    fprintf(fp, "{\"count\":%llu,\"mean_us\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,\"buckets\":[",
+            (unsigned long long)count,
+            count > 0 ? (double)load(&histogram->total_ns) / (double)count / 1000.0 : 0.0,
+            shred_histogram_quantile(histogram, 0.5), shred_histogram_quantile(histogram, 0.99),
+            (double)load(&histogram->max_ns) / 1000.0);
+
+    // Only buckets that saw a call, as [upper edge in us, count]
+    int first = 1;
+    for (unsigned int i = 0; i < SHRED_STATS_BUCKETS; i++) {
+        uint64_t n = load(&histogram->counts[i]);
+        if (n > 0) {
+            fprintf(fp, "%s[%.0f,%llu]", first ? "" : ",", bucket_edge(i), (unsigned long long)n);
+            first = 0;
+        }
+    }
+    fprintf(fp, "]}");
+}
+
+int shred_stats_write_json(ShredStats* stats, FILE* fp, int final) {
+    unsigned int pass_count = atomic_load_explicit(&stats->pass_count, memory_order_relaxed);
+
+    fprintf(fp, "{\"final\":%s,\"elapsed_seconds\":%.3f,\"files\":%llu,\"failures\":%llu,\"passes\":[",
+            final ? "true" : "false",
+            (double)shred_stats_clock() / NS_PER_SECOND - stats->started,
+            (unsigned long long)load(&stats->files), (unsigned long long)load(&stats->failures));
+    for (unsigned int i = 0; i < pass_count; i++) {
+        fprintf(fp, "%s{\"pass\":%u,", i == 0 ? "" : ",", i + 1);
+        write_stage(fp, &stats->passes[i]);
+    }
+    fprintf(fp, "],\"verify\":{");
+    write_stage(fp, &stats->verify);
+    fprintf(fp, ",\"discard\":{");
+    write_stage(fp, &stats->discard);
+    fprintf(fp, ",\"write_latency\":");
+    write_histogram(fp, &stats->write_latency);
+    fprintf(fp, ",\"sync_latency\":");
+    write_histogram(fp, &stats->sync_latency);
+    fprintf(fp, "}\n");
+
+    return fflush(fp) == 0 && !ferror(fp) ? 0 : -1;
+}
@@ -0,0 +1,77 @@
+#ifndef SHRED_STATS_H
+#define SHRED_STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Latency histograms use power-of-two buckets in microseconds: bucket 0
+// counts calls under 1 us, bucket i those from 2^(i-1) up to 2^i us
+#define SHRED_STATS_BUCKETS 32
+
+// Passes with a record of their own (Gutmann has 35); any further passes
+// are added to the last record
+#define SHRED_STATS_MAX_PASSES 64
+
+typedef struct {
+    _Atomic uint64_t counts[SHRED_STATS_BUCKETS];
+    _Atomic uint64_t total_ns;
+    _Atomic uint64_t max_ns;
+} ShredHistogram;
+
+// Totals of one stage (a pass, verification or the discard), summed over
+// every worker and file. Times are worker nanoseconds, so with several
+// workers they can add up to more than the elapsed time.
+typedef struct {
+    _Atomic uint64_t wall_ns;
+    _Atomic uint64_t cpu_ns;        // thread CPU time, user and system
+    _Atomic uint64_t generate_ns;   // building pattern tiles and keystream
+    _Atomic uint64_t write_ns;      // in write calls and waiting for queued writes
+    _Atomic uint64_t read_ns;
+    _Atomic uint64_t flush_ns;      // draining the writer and syncing
+    _Atomic uint64_t bytes_written;
+    _Atomic uint64_t bytes_read;
+    _Atomic uint64_t syscalls;
+    _Atomic uint64_t short_writes;  // writes the kernel only partly completed
+    _Atomic uint64_t errors;        // failed write, read and sync calls
+} ShredStatsStage;
+
+// Instrumentation of one or more shreds. Like ShredProgress it is only
+// added to with relaxed atomics and can be dumped while workers run.
+typedef struct {
+    ShredStatsStage passes[SHRED_STATS_MAX_PASSES];
+    ShredStatsStage verify;
+    ShredStatsStage discard;
+    _Atomic unsigned int pass_count;  // most passes of any job
+    _Atomic uint64_t files;
+    _Atomic uint64_t failures;
+    ShredHistogram write_latency;
+    ShredHistogram sync_latency;
+    double started;
+} ShredStats;
+
+void shred_stats_init(ShredStats* stats);
+
+static inline void shred_stats_add(_Atomic uint64_t* counter, uint64_t value) {
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+// Monotonic and calling-thread CPU clocks, in nanoseconds
+uint64_t shred_stats_clock(void);
+uint64_t shred_stats_cpu_clock(void);
+
+// Record for pass (0-based) of a job with pass_count passes
+ShredStatsStage* shred_stats_pass(ShredStats* stats, size_t pass, size_t pass_count);
+
+void shred_histogram_record(ShredHistogram* histogram, uint64_t ns);
+
+// Upper edge, in microseconds, of the bucket holding quantile q (0.0 - 1.0),
+// capped at the slowest call recorded
+double shred_histogram_quantile(ShredHistogram* histogram, double q);
+
+// Writes everything recorded so far as one line of JSON; final marks the
+// dump taken once the work is done
+int shred_stats_write_json(ShredStats* stats, FILE* fp, int final);
+
+#endif /* SHRED_STATS_H */
@@ -0,0 +1,101 @@
+#include "shred_store.h"
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+static void stream_memcpy(unsigned char* dst, const unsigned char* src, size_t length) {
+    memcpy(dst, src, length);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Bytes to copy normally before dst reaches alignment
+static size_t head_length(const unsigned char* dst, size_t alignment, size_t length) {
+    size_t head = (alignment - (uintptr_t)dst % alignment) % alignment;
+    return head < length ? head : length;
+}
+
+static void stream_sse2(unsigned char* dst, const unsigned char* src, size_t length) {
+    size_t head = head_length(dst, 16, length);
+    memcpy(dst, src, head);
+
+    size_t i = head;
+    for (; i + 64 <= length; i += 64) {
+        __m128i x0 = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i x1 = _mm_loadu_si128((const __m128i*)(src + i + 16));
+        __m128i x2 = _mm_loadu_si128((const __m128i*)(src + i + 32));
+        __m128i x3 = _mm_loadu_si128((const __m128i*)(src + i + 48));
+        _mm_stream_si128((__m128i*)(dst + i), x0);
+        _mm_stream_si128((__m128i*)(dst + i + 16), x1);
+        _mm_stream_si128((__m128i*)(dst + i + 32), x2);
+        _mm_stream_si128((__m128i*)(dst + i + 48), x3);
+    }
+    for (; i + 16 <= length; i += 16) {
+        _mm_stream_si128((__m128i*)(dst + i), _mm_loadu_si128((const __m128i*)(src + i)));
+    }
+
+    // Streaming stores are weakly ordered; make them visible before the
+    // caller syncs or unmaps
+    _mm_sfence();
+    memcpy(dst + i, src + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static void stream_avx2(unsigned char* dst, const unsigned char* src, size_t length) {
+    size_t head = head_length(dst, 32, length);
+    memcpy(dst, src, head);
+
+    // 128 bytes, two full cache lines, per iteration
+    size_t i = head;
+    for (; i + 128 <= length; i += 128) {
+        __m256i x0 = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i x1 = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+        __m256i x2 = _mm256_loadu_si256((const __m256i*)(src + i + 64));
+        __m256i x3 = _mm256_loadu_si256((const __m256i*)(src + i + 96));
+        _mm256_stream_si256((__m256i*)(dst + i), x0);
+        _mm256_stream_si256((__m256i*)(dst + i + 32), x1);
+        _mm256_stream_si256((__m256i*)(dst + i + 64), x2);
+        _mm256_stream_si256((__m256i*)(dst + i + 96), x3);
+    }
+    for (; i + 32 <= length; i += 32) {
+        _mm256_stream_si256((__m256i*)(dst + i), _mm256_loadu_si256((const __m256i*)(src + i)));
+    }
+
+    _mm_sfence();
+    memcpy(dst + i, src + i, length - i);
+}
+
+#endif
+
+typedef void (*StoreKernel)(unsigned char*, const unsigned char*, size_t);
+
+static StoreKernel store_kernel = stream_memcpy;
+static const char* store_kernel_name = "memcpy";
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void select_kernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        store_kernel = stream_avx2;
+        store_kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        store_kernel = stream_sse2;
+        store_kernel_name = "sse2";
+    }
+#endif
+}
+
+void shred_store_stream(void* dst, const void* src, size_t length) {
+    pthread_once(&kernel_once, select_kernel);
+    store_kernel(dst, src, length);
+}
+
+const char* shred_store_kernel_name(void) {
+    pthread_once(&kernel_once, select_kernel);
+    return store_kernel_name;
+}
@@ -0,0 +1,16 @@
+#ifndef SHRED_STORE_H
+#define SHRED_STORE_H
+
+#include <stddef.h>
+
+// Copies length bytes from src to dst with non-temporal (streaming)
+// stores, which write around the CPU caches instead of evicting whatever
+// else runs on the host to make room for data that is never read again.
+// Dispatches to an AVX2 or SSE2 kernel at run time and falls back to
+// memcpy where the CPU has neither. The buffers must not overlap.
+void shred_store_stream(void* dst, const void* src, size_t length);
+
+// Name of the kernel shred_store_stream dispatches to
+const char* shred_store_kernel_name(void);
+
+#endif /* SHRED_STORE_H */
@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include "shred_throttle.h"
+#include "shred_io.h"
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+void shred_throttle_init(ShredThrottle* throttle, const ShredThrottleLimits* limits) {
+    memset(throttle, 0, sizeof(*throttle));
+    pthread_mutex_init(&throttle->lock, NULL);
+    if (limits) {
+        throttle->limits = *limits;
+    }
+    throttle->refilled = shred_io_now();
+    throttle->window_started = throttle->refilled;
+}
+
+void shred_throttle_init_job(ShredThrottle* throttle, ShredThrottle* parent) {
+    shred_throttle_init(throttle, NULL);
+    throttle->parent = parent;
+}
+
+void shred_throttle_destroy(ShredThrottle* throttle) {
+    pthread_mutex_destroy(&throttle->lock);
+}
+
+void shred_throttle_set(ShredThrottle* throttle, const ShredThrottleLimits* limits) {
+    pthread_mutex_lock(&throttle->lock);
+    throttle->limits = *limits;
+    if (limits->latency_target <= 0.0) {
+        throttle->adaptive_rate = 0.0;
+        throttle->ceiling = 0.0;
+    }
+    pthread_mutex_unlock(&throttle->lock);
+}
+
+void shred_throttle_get(ShredThrottle* throttle, ShredThrottleLimits* limits) {
+    pthread_mutex_lock(&throttle->lock);
+    *limits = throttle->limits;
+    pthread_mutex_unlock(&throttle->lock);
+}
+
+// The byte limit after any adaptive back-off; called with the lock held
+static double byte_rate(const ShredThrottle* throttle) {
+    double limit = throttle->limits.bytes_per_second;
+
+    if (throttle->adaptive_rate > 0.0 && (limit <= 0.0 || throttle->adaptive_rate < limit)) {
+        return throttle->adaptive_rate;
+    }
+    return limit;
+}
+
+double shred_throttle_rate(ShredThrottle* throttle) {
+    pthread_mutex_lock(&throttle->lock);
+    double rate = byte_rate(throttle);
+    pthread_mutex_unlock(&throttle->lock);
+    return rate;
+}
+
+// Refills tokens for elapsed seconds at rate, up to the burst, and takes
+// amount from them. Returns how long the caller has to wait for its debt.
+static double draw(double* tokens, double rate, double elapsed, double amount) {
+    if (rate <= 0.0) {
+        *tokens = 0.0;
+        return 0.0;
+    }
+
+    *tokens = fmin(*tokens + elapsed * rate, rate * SHRED_THROTTLE_BURST) - amount;
+    return *tokens < 0.0 ? -*tokens / rate : 0.0;
+}
+
+static double reserve(ShredThrottle* bucket, size_t bytes) {
+    double bytes_rate = 0.0;
+    double ops_rate = 0.0;
+
+    // Job limits live in the shared throttle, so changing them there
+    // reaches the buckets of jobs already running
+    if (bucket->parent) {
+        pthread_mutex_lock(&bucket->parent->lock);
+        bytes_rate = bucket->parent->limits.job_bytes_per_second;
+        ops_rate = bucket->parent->limits.job_ops_per_second;
+        pthread_mutex_unlock(&bucket->parent->lock);
+    }
+
+    pthread_mutex_lock(&bucket->lock);
+    if (!bucket->parent) {
+        bytes_rate = byte_rate(bucket);
+        ops_rate = bucket->limits.ops_per_second;
+    }
+
+    double now = shred_io_now();
+    double elapsed = now - bucket->refilled;
+    bucket->refilled = now;
+    double wait = fmax(draw(&bucket->bytes, bytes_rate, elapsed, (double)bytes),
+                       draw(&bucket->ops, ops_rate, elapsed, 1.0));
+    pthread_mutex_unlock(&bucket->lock);
+    return wait;
+}
+
+static void pause_for(double seconds) {
+    struct timespec delay;
+    delay.tv_sec = (time_t)seconds;
+    delay.tv_nsec = (long)((seconds - (double)delay.tv_sec) * 1e9);
+
+    // Signals (the CLI reloads its limits on SIGHUP) must not cut the wait short
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+    }
+}
+
+void shred_throttle_acquire(ShredThrottle* throttle, size_t bytes) {
+    for (ShredThrottle* bucket = throttle; bucket; bucket = bucket->parent) {
+        double wait = reserve(bucket, bytes);
+        if (wait > 0.0) {
+            pause_for(wait);
+        }
+    }
+}
+
+void shred_throttle_observe(ShredThrottle* throttle, size_t bytes, double seconds) {
+    // Latency is judged over everything sharing the device, not per job
+    while (throttle->parent) {
+        throttle = throttle->parent;
+    }
+
+    pthread_mutex_lock(&throttle->lock);
+    double target = throttle->limits.latency_target;
+    if (target <= 0.0) {
+        pthread_mutex_unlock(&throttle->lock);
+        return;
+    }
+
+    throttle->latency = throttle->latency > 0.0 ? throttle->latency * 0.875 + seconds * 0.125 : seconds;
+    throttle->window_bytes += bytes;
+
+    double now = shred_io_now();
+    double elapsed = now - throttle->window_started;
+    if (elapsed >= SHRED_THROTTLE_ADJUST_INTERVAL) {
+        double limit = throttle->limits.bytes_per_second;
+        double measured = (double)throttle->window_bytes / elapsed;
+
+        if (throttle->latency > target) {
+            // Multiplicative decrease from what is actually getting through;
+            // without a limit that is also where the rate climbs back to
+            double current = throttle->adaptive_rate > 0.0 ? throttle->adaptive_rate : measured;
+            if (limit > 0.0 && current > limit) {
+                current = limit;
+            }
+            if (throttle->ceiling <= 0.0) {
+                throttle->ceiling = measured;
+            }
+            throttle->adaptive_rate = fmax(current / 2.0, SHRED_THROTTLE_MIN_RATE);
+            // Judge the new rate on writes issued under it
+            throttle->latency = 0.0;
+        } else if (throttle->adaptive_rate > 0.0) {
+            double ceiling = limit > 0.0 ? limit : throttle->ceiling;
+            throttle->adaptive_rate += ceiling / 16.0;
+            if (throttle->adaptive_rate >= ceiling) {
+                throttle->adaptive_rate = 0.0;
+                throttle->ceiling = 0.0;
+            }
+        }
+
+        throttle->window_started = now;
+        throttle->window_bytes = 0;
+    }
+    pthread_mutex_unlock(&throttle->lock);
+}
@@ -0,0 +1,72 @@
+#ifndef SHRED_THROTTLE_H
+#define SHRED_THROTTLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Seconds of full-rate I/O a bucket can save up while idle
+#define SHRED_THROTTLE_BURST 0.1
+
+// How often the adaptive mode looks at the write latency, in seconds
+#define SHRED_THROTTLE_ADJUST_INTERVAL 0.25
+
+// The adaptive mode never backs off below this many bytes per second
+#define SHRED_THROTTLE_MIN_RATE (1024.0 * 1024.0)
+
+// Every limit is per second; 0 lifts it
+typedef struct {
+    double bytes_per_second;      // over every job sharing the throttle
+    double ops_per_second;
+    double job_bytes_per_second;  // for each job on its own
+    double job_ops_per_second;
+    double latency_target;        // seconds of write latency that make the adaptive mode back off, 0 disables it
+} ShredThrottleLimits;
+
+// Token bucket for bytes and I/O calls. A shared throttle carries the
+// global limits and the per-job ones, which the engine applies through a
+// bucket of its own for each job that points back at the shared one.
+// Calls that overdraw a bucket go into debt and sleep it off, so large
+// writes are let through at the average rate rather than starved.
+//
+// In adaptive mode the shared throttle also watches how long writes take.
+// Once the smoothed latency passes the target it halves its byte rate,
+// starting from the throughput it measured, and then raises it step by
+// step while the latency stays below the target, up to the configured
+// limit.
+typedef struct ShredThrottle {
+    pthread_mutex_t lock;
+    ShredThrottleLimits limits;
+    struct ShredThrottle* parent;  // shared throttle of a job bucket, NULL for the shared one
+    double bytes;                  // tokens, negative while in debt
+    double ops;
+    double refilled;
+    // Adaptive mode
+    double adaptive_rate;          // bytes per second while backing off, 0 otherwise
+    double ceiling;                // rate the back-off climbs back to
+    double latency;                // smoothed write latency in seconds
+    double window_started;
+    uint64_t window_bytes;
+} ShredThrottle;
+
+void shred_throttle_init(ShredThrottle* throttle, const ShredThrottleLimits* limits);
+
+// A bucket for one job, limited by the job limits of parent
+void shred_throttle_init_job(ShredThrottle* throttle, ShredThrottle* parent);
+void shred_throttle_destroy(ShredThrottle* throttle);
+
+// Replaces the limits while jobs run; waits already begun are not cut short
+void shred_throttle_set(ShredThrottle* throttle, const ShredThrottleLimits* limits);
+void shred_throttle_get(ShredThrottle* throttle, ShredThrottleLimits* limits);
+
+// Takes bytes and one call from the bucket (and its parent), sleeping until
+// the limits allow them
+void shred_throttle_acquire(ShredThrottle* throttle, size_t bytes);
+
+// Reports a finished write of bytes that took seconds, for the adaptive mode
+void shred_throttle_observe(ShredThrottle* throttle, size_t bytes, double seconds);
+
+// Current byte rate in force, after any adaptive back-off; 0 when unlimited
+double shred_throttle_rate(ShredThrottle* throttle);
+
+#endif /* SHRED_THROTTLE_H */
@@ -0,0 +1,434 @@
+#define _GNU_SOURCE
+#include "shred_tune.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/rand.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+
+static const char* tune_mode_names[] = { "off", "profile", "auto", "fresh" };
+
+const char* shred_tune_mode_name(ShredTuneMode mode) {
+    if ((size_t)mode >= sizeof(tune_mode_names) / sizeof(tune_mode_names[0])) {
+        return "unknown";
+    }
+
+    return tune_mode_names[mode];
+}
+
+int shred_tune_mode_from_name(const char* name, ShredTuneMode* mode) {
+    for (size_t i = 0; i < sizeof(tune_mode_names) / sizeof(tune_mode_names[0]); i++) {
+        if (strcmp(name, tune_mode_names[i]) == 0) {
+            *mode = (ShredTuneMode)i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int shred_tune_default_profile(char* path, size_t size) {
+    const char* home = getenv("HOME");
+    if (!home || !*home) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    int length = snprintf(path, size, "%s/%s", home, SHRED_TUNE_PROFILE_NAME);
+    if (length < 0 || (size_t)length >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+// Reads a number from the sysfs queue directory of dev
+static int queue_attribute(dev_t dev, const char* name, long* value) {
+#ifdef __linux__
+    // Partitions keep their queue attributes on the parent disk
+    static const char* formats[] = {
+        "/sys/dev/block/%u:%u/queue/%s",
+        "/sys/dev/block/%u:%u/../queue/%s"
+    };
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        char path[160];
+        snprintf(path, sizeof(path), formats[i], major(dev), minor(dev), name);
+
+        FILE* fp = fopen(path, "r");
+        if (fp) {
+            int read = fscanf(fp, "%ld", value);
+            fclose(fp);
+            return read == 1 ? 0 : -1;
+        }
+    }
+#else
+    (void)dev;
+    (void)name;
+    (void)value;
+#endif
+
+    return -1;
+}
+
+int shred_tune_probe(int fd, ShredDeviceInfo* info) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+
+    memset(info, 0, sizeof(*info));
+    info->device = shred_io_is_device(fd) ? st.st_rdev : st.st_dev;
+    info->fs_block = shred_io_block_size(fd, 1);
+    info->rotational = -1;
+
+    long value;
+    if (queue_attribute(info->device, "rotational", &value) == 0) {
+        info->rotational = value != 0;
+    }
+    if (queue_attribute(info->device, "optimal_io_size", &value) == 0 && value > 0) {
+        info->optimal_io = (size_t)value;
+    }
+    return 0;
+}
+
+// Throughput of one candidate in MB/s, written and synced; 0 when it
+// cannot run here, including when the writer falls back to another backend
+// at open or on the way
+static double measure(int fd, off_t offset, off_t length, ShredBackend backend, size_t block_size,
+                      unsigned int queue_depth) {
+    off_t count = length / (off_t)block_size;
+    if (count == 0) {
+        return 0.0;
+    }
+
+    ShredWriter writer;
+    if (shred_writer_open(&writer, fd, backend, block_size, queue_depth) != 0) {
+        return 0.0;
+    }
+    if (writer.backend != backend) {
+        shred_writer_close(&writer);
+        return 0.0;
+    }
+
+    // Incompressible, so devices that compress or deduplicate do not look
+    // faster than they are for the random passes
+    int status = 0;
+    for (unsigned int i = 0; i < writer.buffer_count && status == 0; i++) {
+        status = RAND_bytes(writer.buffers[i].data, (int)block_size) == 1 ? 0 : -1;
+    }
+
+    double started = shred_io_now();
+    for (off_t i = 0; i < count && status == 0; i++) {
+        unsigned char* buffer = shred_writer_buffer(&writer);
+        status = buffer ? shred_writer_write(&writer, buffer, block_size, offset + i * (off_t)block_size) : -1;
+    }
+    if (status == 0) {
+        status = shred_writer_sync(&writer);
+    }
+    double elapsed = shred_io_now() - started;
+    int fell_back = writer.backend != backend;
+    shred_writer_close(&writer);
+
+    if (status != 0 || fell_back || elapsed <= 0.0) {
+        return 0.0;
+    }
+    return (double)(count * (off_t)block_size) / elapsed / 1e6;
+}
+
+// Keeps the candidate when it beats the best so far by the margin
+static void consider(ShredTuning* tuning, double mbps, ShredBackend backend, size_t block_size,
+                     unsigned int queue_depth) {
+    if (mbps <= 0.0 || (tuning->mbps > 0.0 && mbps < tuning->mbps * SHRED_TUNE_MARGIN)) {
+        return;
+    }
+
+    tuning->backend = backend;
+    tuning->block_size = block_size;
+    tuning->queue_depth = queue_depth;
+    tuning->mbps = mbps;
+}
+
+int shred_tune_calibrate(int fd, off_t offset, off_t length, int allocated, const ShredDeviceInfo* info,
+                         ShredTuning* tuning) {
+    static const size_t block_sizes[] = { 4 << 20, 128 << 10, 1 << 20, 16 << 20 };
+    static const ShredBackend backends[] = { SHRED_BACKEND_PWRITE, SHRED_BACKEND_DIRECT };
+    static const unsigned int queue_depths[] = { 4, 8, 16 };
+
+    tuning->info = *info;
+    tuning->mbps = 0.0;
+    tuning->cached = 0;
+
+    // The built-in defaults go first, so they win every close call
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        for (size_t k = 0; k < sizeof(block_sizes) / sizeof(block_sizes[0]); k++) {
+            // Small writes only cost a spinning disk rotations
+            if (info->rotational == 1 && block_sizes[k] < (1 << 20)) {
+                continue;
+            }
+
+            // Whole multiples of what the device reports as its best size
+            size_t block_size = block_sizes[k];
+            if (info->optimal_io > 0 && block_size % info->optimal_io != 0) {
+                block_size = (block_size / info->optimal_io + 1) * info->optimal_io;
+            }
+            block_size = shred_io_block_size(fd, block_size);
+            consider(tuning, measure(fd, offset, length, backends[b], block_size, SHRED_QUEUE_DEPTH),
+                     backends[b], block_size, SHRED_QUEUE_DEPTH);
+        }
+    }
+
+    // Streaming stores leave the block size to the staging buffer
+    size_t block_size = shred_io_block_size(fd, SHRED_BUFFER_SIZE);
+    if (allocated) {
+        consider(tuning, measure(fd, offset, length, SHRED_BACKEND_MMAP, block_size, SHRED_QUEUE_DEPTH),
+                 SHRED_BACKEND_MMAP, block_size, SHRED_QUEUE_DEPTH);
+    }
+
+    // Queue depths at the best direct write size so far, capped so the
+    // deepest queue keeps its buffers in reason
+    if (tuning->backend == SHRED_BACKEND_DIRECT && tuning->block_size <= SHRED_BUFFER_SIZE) {
+        block_size = tuning->block_size;
+    }
+    for (size_t d = 0; d < sizeof(queue_depths) / sizeof(queue_depths[0]); d++) {
+        // A spinning disk gains nothing from more than a few writes in flight
+        if (info->rotational == 1 && queue_depths[d] > 4) {
+            break;
+        }
+        consider(tuning, measure(fd, offset, length, SHRED_BACKEND_URING, block_size, queue_depths[d]),
+                 SHRED_BACKEND_URING, block_size, queue_depths[d]);
+    }
+
+    if (tuning->mbps <= 0.0) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+// One profile line: device, what it probed as, and the settings that won
+#define PROFILE_FORMAT "%u:%u %d %zu %zu %15s %zu %u %lf"
+
+int shred_tune_load(const char* profile, const ShredDeviceInfo* info, ShredTuning* tuning) {
+    FILE* fp = fopen(profile, "r");
+    if (!fp) {
+        return -1;
+    }
+
+    char line[256];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), fp)) {
+        unsigned int major_number, minor_number, queue_depth;
+        int rotational;
+        size_t fs_block, optimal_io, block_size;
+        char backend[16];
+        double mbps;
+
+        if (line[0] == '#' ||
+            sscanf(line, PROFILE_FORMAT, &major_number, &minor_number, &rotational, &fs_block, &optimal_io,
+                   backend, &block_size, &queue_depth, &mbps) != 9) {
+            continue;
+        }
+
+        // A different disk behind the same number probes differently
+        if (makedev(major_number, minor_number) != info->device || rotational != info->rotational ||
+            fs_block != info->fs_block || optimal_io != info->optimal_io || block_size == 0 ||
+            shred_backend_from_name(backend, &tuning->backend) != 0) {
+            continue;
+        }
+
+        tuning->info = *info;
+        tuning->block_size = block_size;
+        tuning->queue_depth = queue_depth;
+        tuning->mbps = mbps;
+        tuning->cached = 1;
+        found = 1;
+    }
+    fclose(fp);
+
+    if (!found) {
+        errno = ENOENT;
+        return -1;
+    }
+    return 0;
+}
+
+int shred_tune_save(const char* profile, const ShredTuning* tuning) {
+    char temporary[PATH_MAX];
+    if (snprintf(temporary, sizeof(temporary), "%s.XXXXXX", profile) >= (int)sizeof(temporary)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = mkstemp(temporary);
+    if (fd < 0) {
+        return -1;
+    }
+    FILE* out = fdopen(fd, "w");
+    if (!out) {
+        int saved_errno = errno;
+        close(fd);
+        unlink(temporary);
+        errno = saved_errno;
+        return -1;
+    }
+
+    fprintf(out, "# device rotational fs_block optimal_io backend block_size queue_depth mbps\n");
+
+    // Entries of every other device are carried over
+    FILE* in = fopen(profile, "r");
+    if (in) {
+        char line[256];
+        while (fgets(line, sizeof(line), in)) {
+            unsigned int major_number, minor_number;
+            if (line[0] == '#' || sscanf(line, "%u:%u", &major_number, &minor_number) != 2 ||
+                makedev(major_number, minor_number) == tuning->info.device) {
+                continue;
+            }
+            fputs(line, out);
+        }
+        fclose(in);
+    }
+
+    fprintf(out, "%u:%u %d %zu %zu %s %zu %u %.1f\n", major(tuning->info.device), minor(tuning->info.device),
+            tuning->info.rotational, tuning->info.fs_block, tuning->info.optimal_io,
+            shred_backend_name(tuning->backend), tuning->block_size, tuning->queue_depth, tuning->mbps);
+
+    if (fclose(out) != 0 || rename(temporary, profile) != 0) {
+        int saved_errno = errno;
+        unlink(temporary);
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+// Creates an unlinked scratch file in the directory path names, or in the
+// one that holds path
+static int open_scratch(const char* path, int directory) {
+    char template[PATH_MAX];
+    const char* slash = strrchr(path, '/');
+    int length;
+
+    if (directory) {
+        length = snprintf(template, sizeof(template), "%s/.zyafs-tune-XXXXXX", path);
+    } else if (slash) {
+        length = snprintf(template, sizeof(template), "%.*s/.zyafs-tune-XXXXXX", (int)(slash - path + 1), path);
+    } else {
+        length = snprintf(template, sizeof(template), ".zyafs-tune-XXXXXX");
+    }
+    if (length < 0 || (size_t)length >= sizeof(template)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = mkstemp(template);
+    if (fd >= 0) {
+        unlink(template);
+    }
+    return fd;
+}
+
+int shred_tune_path(const char* path, int device, ShredTuneMode mode, const char* profile, ShredTuning* tuning) {
+    memset(tuning, 0, sizeof(*tuning));
+    if (mode == SHRED_TUNE_OFF) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return -1;
+    }
+
+    int disk = S_ISBLK(st.st_mode);
+#ifdef __APPLE__
+    disk = disk || S_ISCHR(st.st_mode);
+#endif
+    if (disk && !device) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd;
+    off_t length = SHRED_TUNE_PROBE_SIZE;
+    if (disk) {
+        fd = open(path, O_RDWR | O_CLOEXEC);
+#ifdef __linux__
+        // An exclusive open fails while the disk is mounted. Only a check,
+        // as the engine makes: a ring tears down after its descriptor is
+        // closed, so a held claim would still block the shred that follows.
+        int claim = fd >= 0 ? open(path, O_RDWR | O_EXCL | O_CLOEXEC) : -1;
+        if (fd >= 0 && claim < 0) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+        if (claim >= 0) {
+            close(claim);
+        }
+#endif
+        off_t size = fd >= 0 ? shred_io_size(fd) : 0;
+        if (size < length) {
+            length = size;
+        }
+    } else {
+        fd = open_scratch(path, S_ISDIR(st.st_mode));
+    }
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (shred_tune_probe(fd, &tuning->info) != 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    if (mode != SHRED_TUNE_FRESH && profile && shred_tune_load(profile, &tuning->info, tuning) == 0) {
+        close(fd);
+        return 0;
+    }
+    if (mode == SHRED_TUNE_PROFILE) {
+        close(fd);
+        errno = ENOENT;
+        return -1;
+    }
+
+    // Allocated up front, so the mmap candidate can map it and a full file
+    // system is found before anything is timed. File systems that cannot
+    // preallocate are still timed, only without the mmap candidate.
+    int status = 0;
+    int allocated = 1;
+    if (!disk) {
+        int error = posix_fallocate(fd, 0, length);
+        if (error == ENOSPC) {
+            errno = error;
+            status = -1;
+        }
+        allocated = error == 0;
+    }
+
+    if (status == 0) {
+        ShredDeviceInfo info = tuning->info;
+        status = shred_tune_calibrate(fd, 0, length, allocated, &info, tuning);
+    }
+    int saved_errno = errno;
+    close(fd);
+
+    // A profile that cannot be written only costs the next run a calibration
+    if (status == 0 && profile) {
+        shred_tune_save(profile, tuning);
+    }
+    errno = saved_errno;
+    return status;
+}
@@ -0,0 +1,76 @@
+#ifndef SHRED_TUNE_H
+#define SHRED_TUNE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "shred_io.h"
+
+// Bytes written per candidate while calibrating; whole writes of the
+// largest candidate block size
+#define SHRED_TUNE_PROBE_SIZE ((off_t)32 << 20)
+
+// A candidate must beat the best one so far by this factor to replace it,
+// so noise does not move a device away from the defaults
+#define SHRED_TUNE_MARGIN 1.05
+
+// Profile in the home directory when the caller names none
+#define SHRED_TUNE_PROFILE_NAME ".zyafs-tune"
+
+typedef enum {
+    SHRED_TUNE_OFF,      // keep the built-in defaults
+    SHRED_TUNE_PROFILE,  // use the profile, never calibrate
+    SHRED_TUNE_AUTO,     // use the profile, calibrating devices it does not know
+    SHRED_TUNE_FRESH     // calibrate again and replace the profile entry
+} ShredTuneMode;
+
+// What the system says about the storage behind a path
+typedef struct {
+    dev_t device;          // the disk itself, or the device of the file system
+    int rotational;        // 1 for spinning disks, 0 for flash, -1 unknown (tmpfs, network)
+    size_t fs_block;       // st_blksize
+    size_t optimal_io;     // queue/optimal_io_size, 0 when the device does not say
+} ShredDeviceInfo;
+
+typedef struct {
+    ShredDeviceInfo info;
+    ShredBackend backend;
+    size_t block_size;
+    unsigned int queue_depth;
+    double mbps;           // what the settings reached on the probe, to stable storage
+    int cached;            // read from the profile rather than measured
+} ShredTuning;
+
+const char* shred_tune_mode_name(ShredTuneMode mode);
+int shred_tune_mode_from_name(const char* name, ShredTuneMode* mode);
+
+// Writes $HOME/SHRED_TUNE_PROFILE_NAME to path; -1 without a home directory
+int shred_tune_default_profile(char* path, size_t size);
+
+// Fills info for the storage fd lives on
+int shred_tune_probe(int fd, ShredDeviceInfo* info);
+
+// Times every candidate backend, block size and queue depth by writing
+// length bytes at offset of fd and syncing them, and keeps the fastest.
+// Without allocated the region may have holes, and the mmap candidate is
+// left out: a store into a hole the file system cannot fill is a SIGBUS.
+int shred_tune_calibrate(int fd, off_t offset, off_t length, int allocated, const ShredDeviceInfo* info,
+                         ShredTuning* tuning);
+
+// The profile entry for info->device, which only counts while the device
+// still probes the same (ENOENT otherwise)
+int shred_tune_load(const char* profile, const ShredDeviceInfo* info, ShredTuning* tuning);
+
+// Adds or replaces the entry of the tuned device; the profile is rewritten
+// through a temporary file, so readers never see half of it
+int shred_tune_save(const char* profile, const ShredTuning* tuning);
+
+// Settings for the device path lives on. A file or directory is
+// calibrated on a scratch file next to it; a disk only with device set,
+// in which case its first SHRED_TUNE_PROBE_SIZE bytes are the scratch
+// region, and never while it is mounted (EBUSY). profile may be NULL to
+// neither read nor write one. Returns -1 when nothing could be learned
+// (the caller keeps its defaults), including for SHRED_TUNE_OFF.
+int shred_tune_path(const char* path, int device, ShredTuneMode mode, const char* profile, ShredTuning* tuning);
+
+#endif /* SHRED_TUNE_H */
@@ -0,0 +1,448 @@
+#include "shred_uring.h"
+#include <errno.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define SHRED_HAVE_URING 1
+#endif
+#endif
+
+#ifdef SHRED_HAVE_URING
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    const unsigned char* data;
+    size_t length;
+    off_t offset;
+    int buffer_index;
+    int busy;
+} RingRequest;
+
+struct ShredRing {
+    int ring_fd;
+    int fd;
+    int fixed_file;
+    int fixed_buffers;
+    unsigned int depth;
+
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    RingRequest* requests;
+    unsigned int* buffer_busy;
+    unsigned int buffer_count;
+    unsigned int inflight;     // queued and not yet completed, including unsubmitted
+    unsigned int unsubmitted;  // on the submission ring, not yet taken by the kernel
+    int error;  // first failure seen in a completion
+};
+
+static int ring_setup(unsigned int entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ring_enter(int ring_fd, unsigned int submit, unsigned int wait) {
+    unsigned int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    shred_io_count_syscalls(1);
+    return (int)syscall(__NR_io_uring_enter, ring_fd, submit, wait, flags, NULL, 0);
+}
+
+static int ring_register(int ring_fd, unsigned int opcode, const void* arg, unsigned int count) {
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, count);
+}
+
+// Finishes the rest of a short write synchronously
+static int complete_short_write(ShredRing* ring, RingRequest* request, size_t done) {
+    while (done < request->length) {
+        ssize_t written = pwrite(ring->fd, request->data + done, request->length - done,
+                                 request->offset + (off_t)done);
+        shred_io_count_syscalls(1);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        if (written == 0) {
+            return EIO;
+        }
+        done += (size_t)written;
+    }
+    return 0;
+}
+
+static void reap_completions(ShredRing* ring) {
+    unsigned int head = *ring->cq_head;
+    unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        RingRequest* request = &ring->requests[cqe->user_data];
+        int error = 0;
+
+        if (cqe->res < 0) {
+            error = -cqe->res;
+        } else if ((size_t)cqe->res < request->length) {
+            shred_io_count_short_write();
+            error = complete_short_write(ring, request, (size_t)cqe->res);
+        }
+
+        if (error && !ring->error) {
+            ring->error = error;
+        }
+        if (request->buffer_index >= 0) {
+            ring->buffer_busy[request->buffer_index]--;
+        }
+        request->busy = 0;
+        ring->inflight--;
+        head++;
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int wait_completion(ShredRing* ring) {
+    while (ring_enter(ring->ring_fd, 0, 1) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+
+    reap_completions(ring);
+    return 0;
+}
+
+// Hands the kernel everything on the submission ring. It may take only
+// part of it, or nothing for now (EAGAIN, EBUSY) until completions free
+// request memory or room on the completion ring.
+static int submit_all(ShredRing* ring) {
+    while (ring->unsubmitted > 0) {
+        int submitted = ring_enter(ring->ring_fd, ring->unsubmitted, 0);
+        if (submitted > 0) {
+            ring->unsubmitted -= (unsigned int)submitted;
+            continue;
+        }
+        if (submitted < 0 && errno == EINTR) {
+            continue;
+        }
+
+        int busy = submitted == 0 || errno == EAGAIN || errno == EBUSY;
+        if (busy && ring->inflight > ring->unsubmitted) {
+            if (wait_completion(ring) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (submitted == 0) {
+            errno = EAGAIN;
+        }
+        return -1;
+    }
+
+    reap_completions(ring);
+    return 0;
+}
+
+static int wait_one(ShredRing* ring) {
+    // Only submitted writes ever complete, and submitting may already
+    // have reaped the completion the caller is after
+    unsigned int inflight = ring->inflight;
+    if (submit_all(ring) != 0) {
+        return -1;
+    }
+    return ring->inflight < inflight ? 0 : wait_completion(ring);
+}
+
+// Whether the kernel knows the opcodes the ring issues; IORING_OP_WRITE
+// came with the probe itself, so a kernel without the probe lacks it too
+static int ring_supported(int ring_fd) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, size);
+    if (!probe) {
+        return 0;
+    }
+
+    int supported = 0;
+    if (ring_register(ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        supported = 1;
+        const unsigned char opcodes[] = { IORING_OP_WRITE, IORING_OP_WRITE_FIXED };
+        for (size_t i = 0; i < sizeof(opcodes); i++) {
+            if (opcodes[i] > probe->last_op || !(probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED)) {
+                supported = 0;
+            }
+        }
+    }
+    free(probe);
+    return supported;
+}
+
+static int take_error(ShredRing* ring) {
+    if (ring->error) {
+        errno = ring->error;
+        ring->error = 0;
+        return -1;
+    }
+    return 0;
+}
+
+ShredRing* shred_ring_open(int fd, unsigned int depth, const ShredBuffer* buffers, unsigned int buffer_count) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ShredRing* ring = calloc(1, sizeof(ShredRing));
+    if (!ring) {
+        return NULL;
+    }
+
+    ring->fd = fd;
+    ring->ring_fd = ring_setup(depth, &params);
+    if (ring->ring_fd < 0) {
+        free(ring);
+        return NULL;
+    }
+    ring->depth = params.sq_entries;
+
+    // Every write would fail with EINVAL; the writer falls back to pwrite
+    if (!ring_supported(ring->ring_fd)) {
+        close(ring->ring_fd);
+        free(ring);
+        errno = ENOSYS;
+        return NULL;
+    }
+
+    // Map the submission ring, completion ring and SQE array
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_size > ring->sq_map_size) {
+            ring->sq_map_size = ring->cq_map_size;
+        }
+        ring->cq_map_size = ring->sq_map_size;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+        shred_ring_close(ring);
+        return NULL;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            ring->cq_map = NULL;
+            shred_ring_close(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        shred_ring_close(ring);
+        return NULL;
+    }
+
+    unsigned char* sq = ring->sq_map;
+    unsigned char* cq = ring->cq_map;
+    ring->sq_tail = (unsigned int*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned int*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned int*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned int*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned int*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    ring->requests = calloc(ring->depth, sizeof(RingRequest));
+    ring->buffer_busy = calloc(buffer_count ? buffer_count : 1, sizeof(unsigned int));
+    ring->buffer_count = buffer_count;
+    if (!ring->requests || !ring->buffer_busy) {
+        shred_ring_close(ring);
+        return NULL;
+    }
+
+    // Fixed files and buffers save a lookup and a page pin per request;
+    // both are optional (older kernels, low RLIMIT_MEMLOCK)
+    if (ring_register(ring->ring_fd, IORING_REGISTER_FILES, &fd, 1) == 0) {
+        ring->fixed_file = 1;
+    }
+
+    struct iovec* iovecs = calloc(buffer_count ? buffer_count : 1, sizeof(struct iovec));
+    if (iovecs) {
+        for (unsigned int i = 0; i < buffer_count; i++) {
+            iovecs[i].iov_base = buffers[i].data;
+            iovecs[i].iov_len = buffers[i].size;
+        }
+        if (buffer_count > 0 && ring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, iovecs, buffer_count) == 0) {
+            ring->fixed_buffers = 1;
+        }
+        free(iovecs);
+    }
+
+    return ring;
+}
+
+int shred_ring_write(ShredRing* ring, int buffer_index, const void* data, size_t length, off_t offset) {
+    while (ring->inflight == ring->depth) {
+        if (wait_one(ring) != 0) {
+            return -1;
+        }
+    }
+
+    if (take_error(ring) != 0) {
+        return -1;
+    }
+
+    // Any idle request slot will do
+    unsigned int slot = 0;
+    while (ring->requests[slot].busy) {
+        slot++;
+    }
+
+    RingRequest* request = &ring->requests[slot];
+    request->data = data;
+    request->length = length;
+    request->offset = offset;
+    request->buffer_index = buffer_index;
+    request->busy = 1;
+
+    unsigned int tail = *ring->sq_tail;
+    unsigned int index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    if (ring->fixed_buffers && buffer_index >= 0) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->buf_index = (unsigned short)buffer_index;
+    } else {
+        sqe->opcode = IORING_OP_WRITE;
+    }
+    if (ring->fixed_file) {
+        sqe->fd = 0;
+        sqe->flags = IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = ring->fd;
+    }
+    sqe->addr = (unsigned long)data;
+    sqe->len = (unsigned int)length;
+    sqe->off = (unsigned long long)offset;
+    sqe->user_data = slot;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (buffer_index >= 0) {
+        ring->buffer_busy[buffer_index]++;
+    }
+    ring->inflight++;
+    ring->unsubmitted++;
+
+    return submit_all(ring);
+}
+
+int shred_ring_wait_buffer(ShredRing* ring, int buffer_index) {
+    while (ring->buffer_busy[buffer_index] > 0) {
+        if (wait_one(ring) != 0) {
+            return -1;
+        }
+    }
+
+    return take_error(ring);
+}
+
+int shred_ring_drain(ShredRing* ring) {
+    while (ring->inflight > 0) {
+        if (wait_one(ring) != 0) {
+            return -1;
+        }
+    }
+
+    return take_error(ring);
+}
+
+void shred_ring_close(ShredRing* ring) {
+    if (!ring) {
+        return;
+    }
+
+    if (ring->sq_map) {
+        shred_ring_drain(ring);
+    }
+
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+
+    close(ring->ring_fd);
+    free(ring->requests);
+    free(ring->buffer_busy);
+    free(ring);
+}
+
+#else
+
+ShredRing* shred_ring_open(int fd, unsigned int depth, const ShredBuffer* buffers, unsigned int buffer_count) {
+    (void)fd;
+    (void)depth;
+    (void)buffers;
+    (void)buffer_count;
+    errno = ENOSYS;
+    return NULL;
+}
+
+int shred_ring_write(ShredRing* ring, int buffer_index, const void* data, size_t length, off_t offset) {
+    (void)ring;
+    (void)buffer_index;
+    (void)data;
+    (void)length;
+    (void)offset;
+    errno = ENOSYS;
+    return -1;
+}
+
+int shred_ring_wait_buffer(ShredRing* ring, int buffer_index) {
+    (void)ring;
+    (void)buffer_index;
+    return 0;
+}
+
+int shred_ring_drain(ShredRing* ring) {
+    (void)ring;
+    return 0;
+}
+
+void shred_ring_close(ShredRing* ring) {
+    (void)ring;
+}
+
+#endif
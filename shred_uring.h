@@ -0,0 +1,30 @@
+#ifndef SHRED_URING_H
+#define SHRED_URING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "shred_io.h"
+
+// Minimal io_uring submission/completion ring driving the writes of one
+// descriptor. Only built on Linux; elsewhere shred_ring_open fails with
+// ENOSYS and the writer falls back to pwrite.
+typedef struct ShredRing ShredRing;
+
+// Registers fd and buffers with a new ring of depth entries. Returns NULL
+// when io_uring is unavailable.
+ShredRing* shred_ring_open(int fd, unsigned int depth, const ShredBuffer* buffers, unsigned int buffer_count);
+
+// Queues a write, first waiting for a completion when depth writes are
+// already in flight. buffer_index selects a registered buffer, or -1 for
+// unregistered memory. Errors from earlier writes are reported here.
+int shred_ring_write(ShredRing* ring, int buffer_index, const void* data, size_t length, off_t offset);
+
+// Blocks until no queued write still references buffer_index
+int shred_ring_wait_buffer(ShredRing* ring, int buffer_index);
+
+// Blocks until every queued write has completed
+int shred_ring_drain(ShredRing* ring);
+
+void shred_ring_close(ShredRing* ring);
+
+#endif /* SHRED_URING_H */
@@ -0,0 +1,308 @@
+#include "shred_verify.h"
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <openssl/rand.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static const char* mode_names[] = { "none", "sample", "full" };
+
+const char* shred_verify_mode_name(ShredVerifyMode mode) {
+    if ((size_t)mode >= sizeof(mode_names) / sizeof(mode_names[0])) {
+        return "unknown";
+    }
+
+    return mode_names[mode];
+}
+
+int shred_verify_mode_from_name(const char* name, ShredVerifyMode* mode) {
+    for (size_t i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++) {
+        if (strcmp(name, mode_names[i]) == 0) {
+            *mode = (ShredVerifyMode)i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static size_t mismatch_scalar(const unsigned char* a, const unsigned char* b, size_t length) {
+    size_t i = 0;
+
+    // Word at a time, then find the byte
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        if (x != y) {
+            break;
+        }
+    }
+
+    for (; i < length; i++) {
+        if (a[i] != b[i]) {
+            return i;
+        }
+    }
+
+    return length;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static size_t mismatch_sse2(const unsigned char* a, const unsigned char* b, size_t length) {
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if (mask != 0xFFFFu) {
+            return i + (size_t)__builtin_ctz(~mask);
+        }
+    }
+
+    return i + mismatch_scalar(a + i, b + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t mismatch_avx2(const unsigned char* a, const unsigned char* b, size_t length) {
+    size_t i = 0;
+
+    // 128 bytes per iteration; locate the byte only once something differs
+    for (; i + 128 <= length; i += 128) {
+        __m256i d0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                      _mm256_loadu_si256((const __m256i*)(b + i)));
+        __m256i d1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i + 32)),
+                                      _mm256_loadu_si256((const __m256i*)(b + i + 32)));
+        __m256i d2 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i + 64)),
+                                      _mm256_loadu_si256((const __m256i*)(b + i + 64)));
+        __m256i d3 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i + 96)),
+                                      _mm256_loadu_si256((const __m256i*)(b + i + 96)));
+        __m256i any = _mm256_or_si256(_mm256_or_si256(d0, d1), _mm256_or_si256(d2, d3));
+        if (!_mm256_testz_si256(any, any)) {
+            break;
+        }
+    }
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (mask != 0xFFFFFFFFu) {
+            return i + (size_t)__builtin_ctz(~mask);
+        }
+    }
+
+    return i + mismatch_scalar(a + i, b + i, length - i);
+}
+
+#elif defined(__aarch64__)
+
+static size_t mismatch_neon(const unsigned char* a, const unsigned char* b, size_t length) {
+    size_t i = 0;
+
+    for (; i + 64 <= length; i += 64) {
+        uint8x16_t d0 = veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        uint8x16_t d1 = veorq_u8(vld1q_u8(a + i + 16), vld1q_u8(b + i + 16));
+        uint8x16_t d2 = veorq_u8(vld1q_u8(a + i + 32), vld1q_u8(b + i + 32));
+        uint8x16_t d3 = veorq_u8(vld1q_u8(a + i + 48), vld1q_u8(b + i + 48));
+        if (vmaxvq_u8(vorrq_u8(vorrq_u8(d0, d1), vorrq_u8(d2, d3))) != 0) {
+            break;
+        }
+    }
+
+    return i + mismatch_scalar(a + i, b + i, length - i);
+}
+
+#endif
+
+typedef size_t (*MismatchKernel)(const unsigned char*, const unsigned char*, size_t);
+
+static MismatchKernel mismatch_kernel = mismatch_scalar;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void select_kernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        mismatch_kernel = mismatch_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        mismatch_kernel = mismatch_sse2;
+    }
+#elif defined(__aarch64__)
+    mismatch_kernel = mismatch_neon;
+#endif
+}
+
+size_t shred_mismatch(const unsigned char* a, const unsigned char* b, size_t length) {
+    pthread_once(&kernel_once, select_kernel);
+    return mismatch_kernel(a, b, length);
+}
+
+void shred_verify_report_init(ShredVerifyReport* report, ShredVerifyMode mode) {
+    memset(report, 0, sizeof(*report));
+    report->mode = mode;
+    report->first_mismatch = -1;
+}
+
+void shred_verify_report_merge(ShredVerifyReport* into, const ShredVerifyReport* from) {
+    into->units_total += from->units_total;
+    into->units_checked += from->units_checked;
+    into->units_mismatched += from->units_mismatched;
+    into->bytes_checked += from->bytes_checked;
+
+    if (from->first_mismatch >= 0 &&
+        (into->first_mismatch < 0 || from->first_mismatch < into->first_mismatch)) {
+        into->first_mismatch = from->first_mismatch;
+    }
+
+    // Ranges are verified in parallel
+    if (from->seconds > into->seconds) {
+        into->seconds = from->seconds;
+    }
+}
+
+double shred_verify_confidence_bound(const ShredVerifyReport* report) {
+    if (report->units_mismatched > 0 || report->units_checked == 0) {
+        return 1.0;
+    }
+    if (report->units_checked >= report->units_total) {
+        return 0.0;
+    }
+
+    // P(no bad unit among n samples) = (1 - p)^n <= 0.05
+    return 1.0 - pow(0.05, 1.0 / (double)report->units_checked);
+}
+
+typedef struct {
+    ShredWriter* writer;
+    ShredVerifyFill fill;
+    void* context;
+    unsigned char* actual;
+    unsigned char* expected;
+    ShredVerifyReport* report;
+} VerifySpan;
+
+// Reads one span (at most a block) and compares it unit by unit
+static int check_span(VerifySpan* span, off_t range_start, off_t offset, size_t length) {
+    if (shred_writer_read(span->writer, span->actual, length, offset) != 0 ||
+        span->fill(span->context, span->expected, offset, length) != 0) {
+        return -1;
+    }
+
+    for (size_t done = 0; done < length; ) {
+        // Units are counted from the start of the range
+        size_t into_unit = (size_t)((offset + (off_t)done - range_start) % SHRED_VERIFY_UNIT);
+        size_t unit = SHRED_VERIFY_UNIT - into_unit;
+        if (unit > length - done) {
+            unit = length - done;
+        }
+
+        size_t at = shred_mismatch(span->actual + done, span->expected + done, unit);
+        if (at < unit) {
+            off_t where = offset + (off_t)(done + at);
+            span->report->units_mismatched++;
+            if (span->report->first_mismatch < 0 || where < span->report->first_mismatch) {
+                span->report->first_mismatch = where;
+            }
+        }
+
+        if (into_unit == 0) {
+            span->report->units_checked++;
+        }
+        done += unit;
+    }
+
+    span->report->bytes_checked += length;
+    return 0;
+}
+
+int shred_verify_range(ShredWriter* writer, off_t start, off_t end, size_t block_size,
+                       ShredVerifyMode mode, double sample_rate,
+                       ShredVerifyFill fill, void* context, ShredVerifyReport* report) {
+    if (mode == SHRED_VERIFY_NONE || end <= start) {
+        return 0;
+    }
+
+    double started = shred_io_now();
+
+    // Make sure the reads come from the device, not the page cache
+    if (shred_writer_sync(writer) != 0) {
+        return -1;
+    }
+    shred_io_drop_cache(writer->fd, start, end - start);
+
+    // Whole units per read, so no unit is split across two reads
+    block_size = (block_size + SHRED_VERIFY_UNIT - 1) / SHRED_VERIFY_UNIT * SHRED_VERIFY_UNIT;
+
+    ShredBuffer actual, expected;
+    if (shred_buffer_acquire(&actual, block_size) != 0) {
+        return -1;
+    }
+    if (shred_buffer_acquire(&expected, block_size) != 0) {
+        shred_buffer_release(&actual);
+        return -1;
+    }
+
+    VerifySpan span = { writer, fill, context, actual.data, expected.data, report };
+    uint64_t units = (uint64_t)((end - start + SHRED_VERIFY_UNIT - 1) / SHRED_VERIFY_UNIT);
+    int status = 0;
+
+    report->units_total += units;
+
+    if (mode == SHRED_VERIFY_FULL) {
+        for (off_t offset = start; offset < end && status == 0; ) {
+            size_t length = block_size;
+            if ((off_t)length > end - offset) {
+                length = (size_t)(end - offset);
+            }
+
+            status = check_span(&span, start, offset, length);
+            offset += (off_t)length;
+        }
+    } else {
+        // Systematic sampling: one unit per stride, from a random phase, so
+        // the samples cover the whole range evenly
+        uint64_t samples = (uint64_t)ceil((double)units * sample_rate);
+        if (samples < 1) {
+            samples = 1;
+        }
+        if (samples > units) {
+            samples = units;
+        }
+
+        uint32_t seed = 0;
+        RAND_bytes((unsigned char*)&seed, sizeof(seed));
+        double stride = (double)units / (double)samples;
+        double phase = stride * ((double)seed / 4294967296.0);
+
+        for (uint64_t i = 0; i < samples && status == 0; i++) {
+            uint64_t unit = (uint64_t)(phase + stride * (double)i);
+            off_t offset = start + (off_t)(unit * SHRED_VERIFY_UNIT);
+            size_t length = SHRED_VERIFY_UNIT;
+            if ((off_t)length > end - offset) {
+                length = (size_t)(end - offset);
+            }
+
+            status = check_span(&span, start, offset, length);
+        }
+    }
+
+    shred_buffer_release(&actual);
+    shred_buffer_release(&expected);
+    report->seconds += shred_io_now() - started;
+
+    if (status == 0 && report->units_mismatched > 0) {
+        errno = EIO;
+        status = -1;
+    }
+
+    return status;
+}
@@ -0,0 +1,52 @@
+#ifndef SHRED_VERIFY_H
+#define SHRED_VERIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "shred_io.h"
+
+// Granularity of sampled verification
+#define SHRED_VERIFY_UNIT (64 * 1024)
+
+typedef enum {
+    SHRED_VERIFY_NONE,
+    SHRED_VERIFY_SAMPLE,  // read back a random, evenly spread subset of units
+    SHRED_VERIFY_FULL     // read back everything the final pass wrote
+} ShredVerifyMode;
+
+typedef struct {
+    ShredVerifyMode mode;
+    uint64_t units_total;       // SHRED_VERIFY_UNIT sized units in the file
+    uint64_t units_checked;
+    uint64_t units_mismatched;
+    uint64_t bytes_checked;
+    off_t first_mismatch;       // -1 when everything matched
+    double seconds;
+} ShredVerifyReport;
+
+// Produces the bytes the final pass should have left at offset
+typedef int (*ShredVerifyFill)(void* context, unsigned char* buffer, off_t offset, size_t length);
+
+const char* shred_verify_mode_name(ShredVerifyMode mode);
+int shred_verify_mode_from_name(const char* name, ShredVerifyMode* mode);
+
+// Index of the first byte where a and b differ, or length when they are
+// equal. Dispatches to an AVX2, SSE2 or NEON kernel at run time.
+size_t shred_mismatch(const unsigned char* a, const unsigned char* b, size_t length);
+
+void shred_verify_report_init(ShredVerifyReport* report, ShredVerifyMode mode);
+void shred_verify_report_merge(ShredVerifyReport* into, const ShredVerifyReport* from);
+
+// With 95% confidence, fewer than this fraction of units are wrong given
+// that every sampled unit matched
+double shred_verify_confidence_bound(const ShredVerifyReport* report);
+
+// Flushes [start, end) to stable storage, drops it from the page cache and
+// compares what the device returns against fill. sample_rate (0.0 - 1.0)
+// is only used in sample mode. Returns 0 when everything read matched.
+int shred_verify_range(ShredWriter* writer, off_t start, off_t end, size_t block_size,
+                       ShredVerifyMode mode, double sample_rate,
+                       ShredVerifyFill fill, void* context, ShredVerifyReport* report);
+
+#endif /* SHRED_VERIFY_H */
@@ -0,0 +1,495 @@
+#define _GNU_SOURCE
+#include "shred_walk.h"
+#include "shred_scrub.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+// Tasks each worker can queue before it starts handling entries in place
+#define QUEUE_CAPACITY 1024
+
+// Directory entries are read in chunks of this size (glibc's readdir
+// uses 32 KiB), so huge cache directories take few getdents calls
+#define DIRENT_BUFFER_SIZE (256 * 1024)
+
+typedef struct WalkDir {
+    char* path;
+    const char* name;     // last component of path, relative to the parent's fd
+    int fd;               // open from the scan until the directory is released
+    // Shredded files waiting to be scrubbed and unlinked, while fd is open
+    ShredScrubBatch scrub;
+    struct WalkDir* parent;
+    atomic_long pending;  // children not yet finished, plus the scan itself
+} WalkDir;
+
+typedef enum {
+    TASK_DIRECTORY,
+    TASK_FILE
+} WalkTaskType;
+
+typedef struct {
+    WalkTaskType type;
+    char* path;
+    const char* name;  // last component of path, for TASK_FILE
+    WalkDir* dir;      // the directory itself for TASK_DIRECTORY, the parent for TASK_FILE
+} WalkTask;
+
+// Reads the entries of an open directory, with getdents64 straight into
+// a large buffer on Linux and readdir elsewhere
+typedef struct {
+#ifdef __linux__
+    int fd;
+    char* buffer;
+    size_t length;
+    size_t position;
+#else
+    DIR* handle;
+#endif
+} DirReader;
+
+#ifdef __linux__
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+typedef struct {
+    pthread_mutex_t lock;
+    WalkTask tasks[QUEUE_CAPACITY];
+    size_t head;  // thieves take from here (oldest)
+    size_t tail;  // the owner pushes and pops here (newest)
+} WalkQueue;
+
+typedef struct {
+    WalkQueue* queues;
+    unsigned int worker_count;
+    ShredWalkFileFunc shred;
+    void* user_data;
+
+    atomic_long queued;       // tasks sitting in any queue
+    atomic_long outstanding;  // tasks queued or running
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+
+    atomic_ullong files;
+    atomic_ullong directories;
+    atomic_ullong failures;
+} Walker;
+
+typedef struct {
+    Walker* walker;
+    unsigned int index;
+} WalkWorker;
+
+static void run_task(Walker* walker, unsigned int self, WalkTask* task);
+
+static int queue_push(WalkQueue* queue, const WalkTask* task) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail - queue->head == QUEUE_CAPACITY) {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    queue->tasks[queue->tail % QUEUE_CAPACITY] = *task;
+    queue->tail++;
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+static int queue_pop(WalkQueue* queue, WalkTask* task) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail == queue->head) {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    // Newest first keeps the walk depth-first and the working set small
+    queue->tail--;
+    *task = queue->tasks[queue->tail % QUEUE_CAPACITY];
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+static int queue_steal(WalkQueue* queue, WalkTask* task) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail == queue->head) {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    // Oldest first hands the thief the biggest remaining subtree
+    *task = queue->tasks[queue->head % QUEUE_CAPACITY];
+    queue->head++;
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+// Only for messages and the callback; the walk itself never resolves
+// paths. *component points at the name inside the result.
+static char* join_path(const char* directory, const char* name, const char** component) {
+    size_t prefix = strlen(directory);
+    size_t length = strlen(name);
+    char* path = malloc(prefix + length + 2);
+    if (path) {
+        memcpy(path, directory, prefix);
+        path[prefix] = '/';
+        memcpy(path + prefix + 1, name, length + 1);
+        *component = path + prefix + 1;
+    }
+    return path;
+}
+
+static int dir_reader_open(DirReader* reader, int fd) {
+#ifdef __linux__
+    reader->fd = fd;
+    reader->length = 0;
+    reader->position = 0;
+    reader->buffer = malloc(DIRENT_BUFFER_SIZE);
+    return reader->buffer ? 0 : -1;
+#else
+    // closedir closes the descriptor it was given, the walk keeps its own
+    int copy = dup(fd);
+    reader->handle = copy >= 0 ? fdopendir(copy) : NULL;
+    if (!reader->handle) {
+        if (copy >= 0) {
+            close(copy);
+        }
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+// Next entry other than . and ..; NULL at the end or on error
+static const char* dir_reader_next(DirReader* reader, unsigned char* type) {
+    for (;;) {
+#ifdef __linux__
+        if (reader->position >= reader->length) {
+            long got = syscall(SYS_getdents64, reader->fd, reader->buffer, DIRENT_BUFFER_SIZE);
+            if (got <= 0) {
+                return NULL;
+            }
+            reader->length = (size_t)got;
+            reader->position = 0;
+        }
+
+        struct linux_dirent64* entry = (struct linux_dirent64*)(reader->buffer + reader->position);
+        reader->position += entry->d_reclen;
+#else
+        struct dirent* entry = readdir(reader->handle);
+        if (!entry) {
+            return NULL;
+        }
+#endif
+
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            *type = entry->d_type;
+            return entry->d_name;
+        }
+    }
+}
+
+static void dir_reader_close(DirReader* reader) {
+#ifdef __linux__
+    free(reader->buffer);
+#else
+    closedir(reader->handle);
+#endif
+}
+
+// Drops one reference; the last one removes the directory and walks up
+static void dir_release(Walker* walker, WalkDir* dir) {
+    while (dir && atomic_fetch_sub(&dir->pending, 1) == 1) {
+        if (dir->fd >= 0) {
+            // The last batch goes before the directory can be removed
+            shred_scrub_destroy(&dir->scrub);
+            atomic_fetch_add(&walker->files, dir->scrub.removed);
+            atomic_fetch_add(&walker->directories, dir->scrub.directories);
+            atomic_fetch_add(&walker->failures, dir->scrub.failed);
+            close(dir->fd);
+        }
+
+        // Scrubbed with the other entries of its parent, which takes over
+        // the path and is only flushed once this reference is dropped; the
+        // root in a batch of its own
+        WalkDir* parent = dir->parent;
+        if (parent) {
+            shred_scrub_add(&parent->scrub, dir->path, dir->name, SHRED_SCRUB_DIRECTORY);
+        } else {
+            if (shred_scrub_directory(AT_FDCWD, dir->path) == 0) {
+                atomic_fetch_add(&walker->directories, 1);
+            } else {
+                // The scrub reports the directories it gets to
+                if (errno != EIO) {
+                    fprintf(stderr, "Error: Unable to remove the directory %s.\n", dir->path);
+                }
+                atomic_fetch_add(&walker->failures, 1);
+            }
+            free(dir->path);
+        }
+
+        free(dir);
+        dir = parent;
+    }
+}
+
+// Queues a task for any worker, or runs it right away when our queue is full
+static void submit(Walker* walker, unsigned int self, WalkTask* task) {
+    atomic_fetch_add(&walker->outstanding, 1);
+    atomic_fetch_add(&walker->queued, 1);
+
+    if (queue_push(&walker->queues[self], task) != 0) {
+        atomic_fetch_sub(&walker->queued, 1);
+        run_task(walker, self, task);
+        atomic_fetch_sub(&walker->outstanding, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&walker->idle_lock);
+    pthread_cond_signal(&walker->idle_cond);
+    pthread_mutex_unlock(&walker->idle_lock);
+}
+
+static void scan_directory(Walker* walker, unsigned int self, WalkDir* dir) {
+    DirReader reader;
+
+    // Opened relative to the parent, which stays open while this runs
+    int parent_fd = dir->parent ? dir->parent->fd : AT_FDCWD;
+    dir->fd = openat(parent_fd, dir->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dir->fd < 0 || dir_reader_open(&reader, dir->fd) != 0) {
+        if (dir->fd >= 0) {
+            close(dir->fd);
+            dir->fd = -1;
+        }
+        fprintf(stderr, "Error: Unable to open the directory %s.\n", dir->path);
+        atomic_fetch_add(&walker->failures, 1);
+        dir_release(walker, dir);
+        return;
+    }
+    shred_scrub_init(&dir->scrub, dir->fd);
+
+    const char* entry;
+    unsigned char type;
+    while ((entry = dir_reader_next(&reader, &type)) != NULL) {
+        const char* name;
+        char* path = join_path(dir->path, entry, &name);
+        if (!path) {
+            atomic_fetch_add(&walker->failures, 1);
+            continue;
+        }
+
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                type = DT_UNKNOWN;
+            } else if (S_ISDIR(st.st_mode)) {
+                type = DT_DIR;
+            } else if (S_ISREG(st.st_mode)) {
+                type = DT_REG;
+            } else if (S_ISLNK(st.st_mode)) {
+                type = DT_LNK;
+            }
+        }
+
+        if (type == DT_DIR) {
+            WalkDir* child = malloc(sizeof(WalkDir));
+            if (!child) {
+                free(path);
+                atomic_fetch_add(&walker->failures, 1);
+                continue;
+            }
+
+            child->path = path;
+            child->name = name;
+            child->fd = -1;
+            child->parent = dir;
+            atomic_init(&child->pending, 1);
+            atomic_fetch_add(&dir->pending, 1);
+
+            WalkTask task = { TASK_DIRECTORY, NULL, NULL, child };
+            submit(walker, self, &task);
+        } else if (type == DT_REG) {
+            atomic_fetch_add(&dir->pending, 1);
+
+            WalkTask task = { TASK_FILE, path, name, dir };
+            submit(walker, self, &task);
+        } else if (type == DT_LNK) {
+            // Never follow links out of the tree, only scrub and remove them
+            shred_scrub_add(&dir->scrub, path, name, SHRED_SCRUB_LINK);
+        } else {
+            fprintf(stderr, "Error: Unsupported file type %s.\n", path);
+            atomic_fetch_add(&walker->failures, 1);
+            free(path);
+        }
+    }
+
+    dir_reader_close(&reader);
+
+    // Release the reference held by the scan itself
+    dir_release(walker, dir);
+}
+
+static void run_task(Walker* walker, unsigned int self, WalkTask* task) {
+    if (task->type == TASK_DIRECTORY) {
+        scan_directory(walker, self, task->dir);
+        return;
+    }
+
+    // The scrub batch takes over the path and counts the file once it is
+    // unlinked; a file that could not be overwritten is left in place
+    if (walker->shred(task->dir->fd, task->name, task->path, walker->user_data) == 0) {
+        shred_scrub_add(&task->dir->scrub, task->path, task->name, SHRED_SCRUB_FILE);
+    } else {
+        atomic_fetch_add(&walker->failures, 1);
+        free(task->path);
+    }
+
+    dir_release(walker, task->dir);
+}
+
+static int next_task(Walker* walker, unsigned int self, WalkTask* task) {
+    if (queue_pop(&walker->queues[self], task) == 0) {
+        return 0;
+    }
+
+    for (unsigned int i = 1; i < walker->worker_count; i++) {
+        if (queue_steal(&walker->queues[(self + i) % walker->worker_count], task) == 0) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static void* walk_worker(void* arg) {
+    WalkWorker* worker = arg;
+    Walker* walker = worker->walker;
+    WalkTask task;
+
+    for (;;) {
+        if (next_task(walker, worker->index, &task) == 0) {
+            atomic_fetch_sub(&walker->queued, 1);
+            run_task(walker, worker->index, &task);
+
+            // The last task to finish wakes everyone up so they can exit
+            if (atomic_fetch_sub(&walker->outstanding, 1) == 1) {
+                pthread_mutex_lock(&walker->idle_lock);
+                pthread_cond_broadcast(&walker->idle_cond);
+                pthread_mutex_unlock(&walker->idle_lock);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&walker->idle_lock);
+        while (atomic_load(&walker->queued) == 0 && atomic_load(&walker->outstanding) > 0) {
+            pthread_cond_wait(&walker->idle_cond, &walker->idle_lock);
+        }
+        int finished = atomic_load(&walker->outstanding) == 0;
+        pthread_mutex_unlock(&walker->idle_lock);
+
+        if (finished) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+int shred_walk(const char* root, unsigned int worker_count, ShredWalkFileFunc shred,
+               void* user_data, ShredWalkStats* stats) {
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    if (worker_count == 0) {
+        worker_count = 1;
+    }
+
+    Walker walker;
+    memset(&walker, 0, sizeof(walker));
+    walker.worker_count = worker_count;
+    walker.shred = shred;
+    walker.user_data = user_data;
+    atomic_init(&walker.queued, 0);
+    atomic_init(&walker.outstanding, 0);
+    atomic_init(&walker.files, 0);
+    atomic_init(&walker.directories, 0);
+    atomic_init(&walker.failures, 0);
+    pthread_mutex_init(&walker.idle_lock, NULL);
+    pthread_cond_init(&walker.idle_cond, NULL);
+
+    walker.queues = calloc(worker_count, sizeof(WalkQueue));
+    WalkWorker* workers = calloc(worker_count, sizeof(WalkWorker));
+    pthread_t* threads = calloc(worker_count, sizeof(pthread_t));
+    WalkDir* top = malloc(sizeof(WalkDir));
+    char* top_path = strdup(root);
+    if (!walker.queues || !workers || !threads || !top || !top_path) {
+        free(walker.queues);
+        free(workers);
+        free(threads);
+        free(top);
+        free(top_path);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < worker_count; i++) {
+        pthread_mutex_init(&walker.queues[i].lock, NULL);
+        workers[i].walker = &walker;
+        workers[i].index = i;
+    }
+
+    top->path = top_path;
+    top->name = top_path;
+    top->fd = -1;
+    top->parent = NULL;
+    atomic_init(&top->pending, 1);
+
+    WalkTask task = { TASK_DIRECTORY, NULL, NULL, top };
+    submit(&walker, 0, &task);
+
+    // Worker 0 runs on the calling thread
+    unsigned int started = 1;
+    for (unsigned int i = 1; i < worker_count; i++) {
+        if (pthread_create(&threads[i], NULL, walk_worker, &workers[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+
+    walk_worker(&workers[0]);
+    for (unsigned int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (unsigned int i = 0; i < worker_count; i++) {
+        pthread_mutex_destroy(&walker.queues[i].lock);
+    }
+    pthread_mutex_destroy(&walker.idle_lock);
+    pthread_cond_destroy(&walker.idle_cond);
+    free(walker.queues);
+    free(workers);
+    free(threads);
+
+    if (stats) {
+        stats->files = atomic_load(&walker.files);
+        stats->directories = atomic_load(&walker.directories);
+        stats->failures = atomic_load(&walker.failures);
+    }
+
+    return atomic_load(&walker.failures) == 0 ? 0 : -1;
+}
@@ -0,0 +1,33 @@
+#ifndef SHRED_WALK_H
+#define SHRED_WALK_H
+
+#include <stdint.h>
+
+// Overwrites the regular file name inside the directory open as dirfd;
+// path names the same file for messages. Returns 0 on success, after
+// which the walk scrubs the file's name and metadata and unlinks it.
+typedef int (*ShredWalkFileFunc)(int dirfd, const char* name, const char* path, void* user_data);
+
+typedef struct {
+    uint64_t files;
+    uint64_t directories;
+    uint64_t failures;
+} ShredWalkStats;
+
+// Hands every regular file below root to shred on worker_count threads.
+// Discovered work sits in per-worker queues of fixed size that idle
+// workers steal from; when a queue is full the entry is processed in
+// place, so memory stays bounded however large the tree is. Directories
+// are opened relative to their parent and read in large getdents
+// batches, and every entry is handled relative to its directory's
+// descriptor, so no full path is ever resolved again. Symbolic links are
+// removed without being followed. Shredded files, links and emptied
+// directories are scrubbed and removed in batches per directory (see
+// shred_scrub.h), with one directory sync per batch. Each directory,
+// root included, is scrubbed as soon as everything inside it is gone.
+// stats is filled even when the walk cannot start.
+// Returns 0 when every entry was handled, -1 otherwise.
+int shred_walk(const char* root, unsigned int worker_count, ShredWalkFileFunc shred,
+               void* user_data, ShredWalkStats* stats);
+
+#endif /* SHRED_WALK_H */
@@ -1,251 +1,351 @@
 #include "shredder.h"
-#include <sodium.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
 #include <gtk/gtk.h>
 
-#define BUFFER_SIZE 1024
-
-static void generate_random_iv(unsigned char *iv, size_t length) {
-    randombytes_buf(iv, length);
-}
-
-
-void overwrite_with_null_bytes(FILE* fp, long file_size, GtkProgressBar* progress_bar) {
-    char null_byte = 0;
-
-    for (long i = 0; i < file_size; i++) {
-        fwrite(&null_byte, sizeof(char), 1, fp);
-
-        // Update the progress bar
-        double progress = (double)i / (double)file_size;
-        gtk_progress_bar_set_fraction(progress_bar, progress);
-        while (gtk_events_pending())
-            gtk_main_iteration();
+// Byte ranges shredded in parallel for each file
+#define SHRED_GUI_WORKERS 3
+
+// Files shredded at the same time; the rest wait in the queue
+#define SHRED_GUI_RUNNERS 2
+
+// Runner queue, shared with the runner threads
+static ShredTask* queue_head;
+static ShredTask* queue_tail;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static pthread_t runners[SHRED_GUI_RUNNERS];
+static int runner_count;
+static int stopping;
+
+// Held while a runner calibrates, so runners never calibrate a device at
+// the same time; the one that waited reads the profile the other saved
+static pthread_mutex_t tune_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Main loop only
+static GList* active_tasks;
+static GtkWidget* queue_dialog;
+static GtkWidget* queue_box;
+static guint progress_timer;
+
+static const char* task_state_text(ShredTaskState state) {
+    switch (state) {
+        case SHRED_TASK_QUEUED:    return "Queued";
+        case SHRED_TASK_RUNNING:   return "Shredding";
+        case SHRED_TASK_DONE:      return "Shredded";
+        case SHRED_TASK_FAILED:    return "Failed";
+        case SHRED_TASK_CANCELLED: return "Cancelled";
     }
+    return "";
 }
 
-void overwrite_with_polymorphic_12_pass(FILE* fp, long file_size, GtkProgressBar* progress_bar) {
+static void set_task_label(ShredTask* task) {
+    gchar *label_text;
 
-    unsigned char key[crypto_stream_chacha20_KEYBYTES];
-    unsigned char iv[crypto_stream_chacha20_NONCEBYTES];
+    if (task->state == SHRED_TASK_RUNNING && task->sample.pass_count > 0) {
+        unsigned int passes_left = task->sample.pass_count - task->sample.pass + 1;
+        label_text = g_strdup_printf("Passes Left: %u\nShredding: %s", passes_left, task->file_path);
+    } else if (task->state == SHRED_TASK_FAILED) {
+        label_text = g_strdup_printf("Failed: %s (%s)", task->file_path, strerror(task->error));
+    } else {
+        label_text = g_strdup_printf("%s: %s", task_state_text(task->state), task->file_path);
+    }
 
-    randombytes_buf(key, sizeof key);
-    
-    fseek(fp, 0, SEEK_SET);
-    long num_iterations = file_size / BUFFER_SIZE;
-    long remainder = file_size % BUFFER_SIZE;
+    gtk_label_set_text(task->label, label_text);
+    g_free(label_text);
+}
 
-    for (int pass = 0; pass < 12; pass++) {
+// Runs on the GTK main loop every SHRED_PROGRESS_INTERVAL_MS; the runners
+// only ever touch the atomic counters
+static gboolean update_progress(gpointer data) {
+    (void)data;
 
-        generate_random_iv(iv, sizeof iv);
+    for (GList* item = active_tasks; item; item = item->next) {
+        ShredTask* task = item->data;
+        char text[128];
 
-        fseek(fp, 0, SEEK_SET);
+        if (task->state != SHRED_TASK_RUNNING) {
+            continue;
+        }
 
-        for (long i = 0; i < num_iterations; i++) {
+        shred_progress_sample(&task->progress, &task->sample);
+        shred_progress_format(&task->sample, text, sizeof(text));
 
-            unsigned char buffer[BUFFER_SIZE];
-            fread(buffer, sizeof(char), BUFFER_SIZE, fp);
+        // Update the progress bar
+        gtk_progress_bar_set_fraction(task->progress_bar, task->sample.fraction);
+        gtk_progress_bar_set_text(task->progress_bar, text);
+        set_task_label(task);
+    }
 
-            unsigned char ciphertext[BUFFER_SIZE];
+    if (!active_tasks) {
+        progress_timer = 0;
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
 
-            crypto_stream_chacha20(ciphertext, sizeof ciphertext, iv, key);
+// Idle callback: a runner picked the task up
+static gboolean task_started(gpointer data) {
+    ShredTask* task = data;
 
-            fseek(fp, -BUFFER_SIZE, SEEK_CUR);
-            fwrite(ciphertext, sizeof(char), BUFFER_SIZE, fp);
+    task->state = SHRED_TASK_RUNNING;
+    set_task_label(task);
+    return G_SOURCE_REMOVE;
+}
 
-            double progress = (double)(i * BUFFER_SIZE) / (double)file_size;
-            gtk_progress_bar_set_fraction(progress_bar, progress);
-            while (gdk_events_pending())
-                gdk_display_flush(gdk_display_get_default());
-        }
+// Idle callback: a runner is done with the task, which is freed here
+static gboolean task_finished(gpointer data) {
+    ShredTask* task = data;
+
+    if (task->status == 0) {
+        task->state = SHRED_TASK_DONE;
+        gtk_progress_bar_set_fraction(task->progress_bar, 1.0);
+        g_print("%s has been securely shredded using %s algorithm.\n",
+                task->file_path, shred_algorithm_name(task->algorithm));
+    } else if (task->error == ECANCELED) {
+        task->state = SHRED_TASK_CANCELLED;
+    } else {
+        task->state = SHRED_TASK_FAILED;
+        g_print("Error: Unable to shred the file %s.\n", task->file_path);
+    }
 
-        // Remainder handling
-        if (remainder > 0) {
+    gtk_progress_bar_set_text(task->progress_bar, task_state_text(task->state));
+    set_task_label(task);
+    gtk_widget_set_sensitive(task->cancel_button, FALSE);
 
-            unsigned char remainder_buffer[remainder];
-            fread(remainder_buffer, sizeof(char), remainder, fp);
+    active_tasks = g_list_remove(active_tasks, task);
+    g_free(task->file_path);
+    free(task);
+    return G_SOURCE_REMOVE;
+}
 
-            unsigned char remainder_ciphertext[remainder];
+static void* runner_main(void* arg) {
+    (void)arg;
 
-            crypto_stream_chacha20(remainder_ciphertext, remainder, iv, key);
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        while (!queue_head && !stopping) {
+            pthread_cond_wait(&queue_ready, &queue_lock);
+        }
+        ShredTask* task = queue_head;
+        if (task) {
+            queue_head = task->next;
+            if (!queue_head) {
+                queue_tail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&queue_lock);
 
-            fseek(fp, -remainder, SEEK_CUR);
-            fwrite(remainder_ciphertext, sizeof(char), remainder, fp);
+        if (!task) {
+            return NULL;
+        }
 
-            double progress = (double)(file_size) / (double)file_size;
-            gtk_progress_bar_set_fraction(progress_bar, progress);
-            while (gdk_events_pending())
-                gdk_display_flush(gdk_display_get_default());
+        if (atomic_load(&task->cancel)) {
+            // Cancelled while it was still waiting
+            task->status = -1;
+            task->error = ECANCELED;
+        } else {
+            g_idle_add(task_started, task);
+
+            ShredOptions options;
+            shred_options_init(&options);
+            options.threads = task->workers;
+            options.progress = &task->progress;
+            options.cancel = &task->cancel;
+
+            // Settings calibrated for the file's device, kept in the same
+            // profile as the command line's
+            char profile[PATH_MAX];
+            ShredTuning tuning;
+            pthread_mutex_lock(&tune_lock);
+            int tuned = shred_tune_path(task->file_path, 0, SHRED_TUNE_AUTO,
+                                        shred_tune_default_profile(profile, sizeof(profile)) == 0 ? profile : NULL,
+                                        &tuning);
+            pthread_mutex_unlock(&tune_lock);
+            if (tuned == 0) {
+                options.backend = tuning.backend;
+                options.block_size = tuning.block_size;
+                options.queue_depth = tuning.queue_depth;
+            }
+
+            // The engine splits the file into one byte range per worker
+            task->status = shred_path(task->file_path, task->algorithm, &options, NULL);
+            task->error = errno;
+            if (task->status == 0 && shred_scrub_file(AT_FDCWD, task->file_path) != 0) {
+                task->status = -1;
+                task->error = errno;
+            }
         }
-    }
-}
 
-void overwrite_with_random_data(FILE* fp, long file_size, GtkProgressBar* progress_bar) {
-    char buffer[BUFFER_SIZE];
-    for (int i = 0; i < BUFFER_SIZE; i++) {
-        buffer[i] = rand() % 256; // Generate random data (0-255)
+        g_idle_add(task_finished, task);
     }
+}
 
-    fseek(fp, 0, SEEK_SET);
-    long num_iterations = file_size / BUFFER_SIZE;
-    long remainder = file_size % BUFFER_SIZE;
+static void cancel_task(GtkWidget *widget, gpointer data) {
+    (void)widget;
+    ShredTask* task = data;
 
-    for (long i = 0; i < num_iterations; i++) {
-        fwrite(buffer, sizeof(char), BUFFER_SIZE, fp);
+    atomic_store(&task->cancel, 1);
+    gtk_widget_set_sensitive(task->cancel_button, FALSE);
+}
 
-        // Update the progress bar
-        double progress = (double)(i * BUFFER_SIZE) / (double)file_size;
-        gtk_progress_bar_set_fraction(progress_bar, progress);
-        while (gtk_events_pending())
-            gtk_main_iteration();
+static void cancel_all(void) {
+    for (GList* item = active_tasks; item; item = item->next) {
+        ShredTask* task = item->data;
+        atomic_store(&task->cancel, 1);
+        gtk_widget_set_sensitive(task->cancel_button, FALSE);
     }
+}
 
-    if (remainder > 0) {
-        fwrite(buffer, sizeof(char), remainder, fp);
+static void queue_dialog_response(GtkDialog *dialog, gint response, gpointer data) {
+    (void)data;
 
-        // Update the progress bar
-        double progress = (double)file_size / (double)(file_size + remainder);
-        gtk_progress_bar_set_fraction(progress_bar, progress);
-        while (gtk_events_pending())
-            gtk_main_iteration();
+    if (response == GTK_RESPONSE_CANCEL) {
+        cancel_all();
+    } else {
+        // Closing only hides the list; queued files keep going
+        gtk_widget_hide(GTK_WIDGET(dialog));
     }
 }
 
-void overwrite_with_gutmann(FILE* fp, long file_size, GtkProgressBar* progress_bar) {
-    // Gutmann 35-pass overwrite patterns
-    unsigned char patterns[35][BUFFER_SIZE];
-    for (int i = 0; i < 35; i++) {
-        for (int j = 0; j < BUFFER_SIZE; j++) {
-            patterns[i][j] = i;
-        }
+static void ensure_queue_dialog(GtkWidget *parent) {
+    if (queue_dialog) {
+        gtk_widget_show_all(queue_dialog);
+        return;
     }
 
-    fseek(fp, 0, SEEK_SET);
-    long num_iterations = file_size / (35 * BUFFER_SIZE);
-    long remainder = file_size % (35 * BUFFER_SIZE);
-
-    for (long i = 0; i < num_iterations; i++) {
-        for (int j = 0; j < 35; j++) {
-            fwrite(patterns[j], sizeof(char), BUFFER_SIZE, fp);
-        }
-
-        // Update the progress bar
-        double progress = (double)(i * 35 * BUFFER_SIZE) / (double)file_size;
-        gtk_progress_bar_set_fraction(progress_bar, progress);
-        while (gtk_events_pending())
-            gtk_main_iteration();
-    }
+    queue_dialog = gtk_dialog_new_with_buttons("Shredding Progress",
+        GTK_WINDOW(gtk_widget_get_toplevel(parent)),
+        0,  // outlives the dialogs it was opened from; the rows point into it
+        "Cancel All", GTK_RESPONSE_CANCEL,
+        "Close", GTK_RESPONSE_CLOSE,
+        NULL);
+    g_signal_connect(queue_dialog, "response", G_CALLBACK(queue_dialog_response), NULL);
+    g_signal_connect(queue_dialog, "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
 
-    if (remainder > 0) {
-        for (int j = 0; j < 35; j++) {
-            fwrite(patterns[j], sizeof(char), remainder, fp);
-        }
+    // Create a vertical box to hold one row per queued file
+    queue_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+    GtkWidget *content_area = gtk_dialog_get_content_area(GTK_DIALOG(queue_dialog));
+    gtk_container_add(GTK_CONTAINER(content_area), queue_box);
 
-        // Update the progress bar
-        double progress = (double)file_size / (double)(file_size + remainder);
-        gtk_progress_bar_set_fraction(progress_bar, progress);
-        while (gtk_events_pending())
-            gtk_main_iteration();
-    }
+    gtk_widget_show_all(queue_dialog);
 }
 
-void* shredder_thread(void* params) {
+static void add_task_row(ShredTask* task) {
+    // Create the label to display the number of passes and the file name
+    GtkWidget *label = gtk_label_new("");
 
-    ShredParams* shred_params = (ShredParams*)params;
-    FILE* fp = shred_params->fp;
-    long file_size = shred_params->file_size;
-    GtkProgressBar* progress_bar = shred_params->progress_bar;
+    // Create the progress bar
+    GtkWidget *progress_bar = gtk_progress_bar_new();
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(progress_bar), TRUE);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(progress_bar), task_state_text(task->state));
 
-    overwrite_with_null_bytes(fp, file_size, progress_bar);
-    overwrite_with_random_data(fp, file_size, progress_bar);
-    overwrite_with_gutmann(fp, file_size, progress_bar);
-    overwrite_with_polymorphic_12_pass(fp, file_size, progress_bar);
+    GtkWidget *cancel_button = gtk_button_new_with_label("Cancel");
+    g_signal_connect(cancel_button, "clicked", G_CALLBACK(cancel_task), task);
 
-    fclose(fp);
-    free(shred_params);
+    GtkWidget *hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_box_pack_start(GTK_BOX(hbox), progress_bar, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(hbox), cancel_button, FALSE, FALSE, 0);
 
-    return NULL;
-}
+    gtk_box_pack_start(GTK_BOX(queue_box), label, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(queue_box), hbox, FALSE, FALSE, 0);
+    gtk_widget_show_all(queue_box);
 
-void shred_file(GtkWidget *widget, gpointer data) {
+    task->label = GTK_LABEL(label);
+    task->progress_bar = GTK_PROGRESS_BAR(progress_bar);
+    task->cancel_button = cancel_button;
+    set_task_label(task);
+}
 
-    const gchar *file_path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(data));
-    if (!file_path) {
+static void enqueue_task(ShredTask* task) {
+    pthread_mutex_lock(&queue_lock);
+    if (queue_tail) {
+        queue_tail->next = task;
+    } else {
+        queue_head = task;
+    }
+    queue_tail = task;
 
-        g_print("Error: Invalid file path.\n");
-        return;
+    // Runners are started on first use and then wait for more work
+    while (runner_count < SHRED_GUI_RUNNERS &&
+           pthread_create(&runners[runner_count], NULL, runner_main, NULL) == 0) {
+        runner_count++;
     }
+    pthread_cond_signal(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+}
 
-    FILE* fp = fopen(file_path, "r+b");
+void shred_file(GtkWidget *widget, gpointer data) {
 
-    if (!fp) {
+    GSList *file_paths = gtk_file_chooser_get_filenames(GTK_FILE_CHOOSER(data));
+    if (!file_paths) {
 
-        g_print("Error: Unable to open the file.\n");
+        g_print("Error: Invalid file path.\n");
         return;
     }
 
-    fseek(fp, 0, SEEK_END);
-    long file_size = ftell(fp);
-    rewind(fp);
-
     GtkWidget *combo = GTK_WIDGET(g_object_get_data(G_OBJECT(data), "combo"));
-    const gchar *selected_algorithm = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(combo));
 
-    // Create the progress bar
-    GtkWidget *progress_bar = gtk_progress_bar_new();
-    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(progress_bar), TRUE);
+    // The combo entries are listed in ShredAlgorithm order
+    gint active = gtk_combo_box_get_active(GTK_COMBO_BOX(combo));
+    ShredAlgorithm algorithm = active >= 0 ? (ShredAlgorithm)active : SHRED_ALGORITHM_NULL_BYTES;
 
-    // Create the label to display the number of passes and the file name
-    GtkWidget *label = gtk_label_new("");
-    gchar *label_text = g_strdup_printf("Passes Left: 3\nShredding: %s", file_path);
-    gtk_label_set_text(GTK_LABEL(label), label_text);
-    g_free(label_text);
+    ensure_queue_dialog(GTK_WIDGET(data));
 
-    // Create a vertical box to hold the label, progress bar, and other components
-    GtkWidget *vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
-    gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, FALSE, 0);
-    gtk_box_pack_start(GTK_BOX(vbox), progress_bar, FALSE, FALSE, 0);
+    for (GSList *item = file_paths; item; item = item->next) {
+        gchar *file_path = item->data;
 
-    // Add the vbox to the dialog
-    GtkWidget *dialog = gtk_dialog_new_with_buttons("Shredding Progress",
-        GTK_WINDOW(gtk_widget_get_toplevel(widget)),
-        GTK_DIALOG_DESTROY_WITH_PARENT,
-        "Cancel", GTK_RESPONSE_CANCEL,
-        NULL);
+        if (access(file_path, R_OK | W_OK) != 0) {
 
-    GtkWidget *content_area = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
-    gtk_container_add(GTK_CONTAINER(content_area), vbox);
+            g_print("Error: Unable to open the file %s.\n", file_path);
+            g_free(file_path);
+            continue;
+        }
 
-    gtk_widget_show_all(dialog);
+        ShredTask* task = calloc(1, sizeof(ShredTask));
+        if (!task) {
+            g_free(file_path);
+            continue;
+        }
+        task->file_path = file_path;
+        task->algorithm = algorithm;
+        task->workers = SHRED_GUI_WORKERS;
+        task->state = SHRED_TASK_QUEUED;
+        task->status = -1;
+        shred_progress_init(&task->progress);
+        atomic_init(&task->cancel, 0);
+
+        add_task_row(task);
+        active_tasks = g_list_append(active_tasks, task);
+        enqueue_task(task);
+    }
+    g_slist_free(file_paths);
 
-    // Create shred parameters to pass to the shredder threads
-    ShredParams* shred_params = (ShredParams*)malloc(sizeof(ShredParams));
-    shred_params->fp = fp;
-    shred_params->file_size = file_size;
-    shred_params->progress_bar = GTK_PROGRESS_BAR(progress_bar);
+    if (active_tasks && !progress_timer) {
+        progress_timer = g_timeout_add(SHRED_PROGRESS_INTERVAL_MS, update_progress, NULL);
+    }
 
-    // Create 3 shredder threads, one for each pass
-    pthread_t threads[3];
+    // Nothing waits here: the algorithm dialog goes away and the main
+    // loop keeps running while the runners work through the queue
+    gtk_widget_destroy(gtk_widget_get_toplevel(widget));
+}
 
-    for (int i = 0; i < 3; i++) {
-        pthread_create(&threads[i], NULL, shredder_thread, shred_params);
-    }
+void shredder_shutdown(void) {
+    cancel_all();
 
-    // Wait for all threads to finish
-    for (int i = 0; i < 3; i++) {
-        pthread_join(threads[i], NULL);
-    }
+    pthread_mutex_lock(&queue_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
 
-    if (remove(file_path) == 0) {
-        g_print("%s has been securely shredded using %s algorithm.\n", file_path, selected_algorithm);
-    } else {
-        g_print("Error: Unable to shred the file.\n");
+    for (int i = 0; i < runner_count; i++) {
+        pthread_join(runners[i], NULL);
     }
-
-    gtk_widget_destroy(dialog); // Close the progress dialog
+    runner_count = 0;
 }
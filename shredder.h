@@ -2,26 +2,39 @@
 #define SHREDDER_H
 
 #include <gtk/gtk.h>
-
-typedef struct {
-    FILE* fp;
-    long file_size;
-    GtkProgressBar* progress_bar;
-} ShredParams;
+#include "shred_engine.h"
+#include "shred_tune.h"
+#include "shred_scrub.h"
 
 typedef enum {
-    SHRED_ALGORITHM_NULL_BYTES,
-    SHRED_ALGORITHM_RANDOM_DATA,
-    SHRED_ALGORITHM_DOD,
-    SHRED_ALGORITHM_GUTMANN,
-    SHRED_ALGORITHM_POLYMORPHIC_12_PASS  // New algorithm added
-} ShredAlgorithm;
+    SHRED_TASK_QUEUED,
+    SHRED_TASK_RUNNING,
+    SHRED_TASK_DONE,
+    SHRED_TASK_FAILED,
+    SHRED_TASK_CANCELLED
+} ShredTaskState;
+
+// One queued file. The runner threads only touch the engine side (progress,
+// cancel, status); everything else belongs to the GTK main loop.
+typedef struct ShredTask {
+    gchar* file_path;
+    ShredAlgorithm algorithm;
+    unsigned int workers;
+    ShredProgress progress;         // written by the engine, sampled by a GTK timeout
+    ShredProgressSample sample;
+    atomic_int cancel;              // checked by the engine at every buffer
+    int status;
+    int error;
+    ShredTaskState state;
+    GtkProgressBar* progress_bar;
+    GtkLabel* label;
+    GtkWidget* cancel_button;
+    struct ShredTask* next;         // runner queue
+} ShredTask;
 
-void overwrite_with_null_bytes(FILE* fp, long file_size, GtkProgressBar* progress_bar);
-void overwrite_with_random_data(FILE* fp, long file_size, GtkProgressBar* progress_bar);
-void overwrite_with_gutmann(FILE* fp, long file_size, GtkProgressBar* progress_bar);
-void overwrite_with_polymorphic_12_pass(FILE* fp, long file_size, GtkProgressBar* progress_bar);  // New function
-void* shredder_thread(void* params);
 void shred_file(GtkWidget *widget, gpointer data);
 
+// Cancels everything still queued or running and waits for the runners
+void shredder_shutdown(void);
+
 #endif /* SHREDDER_H */